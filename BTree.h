@@ -0,0 +1,1017 @@
+#pragma once
+#include <memory>
+#include <iostream>
+#include <deque>
+#include <iterator>
+#include <utility>
+#include <algorithm>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "Three_Way.h"
+#include "Key_Search.h"
+
+
+// B-tree set with the interface of Tree.
+// A node keeps up to mc_max_keys sorted keys in one array of about
+// Node_Bytes, so a lookup reads a few adjacent cache lines per level
+// and the tree is log_B(n) deep: 5 levels for 30M ints with the
+// default 256 bytes, against ~25 levels of binary nodes.
+// Keys move between nodes when they split, merge or borrow, so unlike
+// Tree insert and erase invalidate iterators and references.
+// Pool_Allocator works too, leaves and inner nodes share its pool.
+//
+// Usage: BTree<int> tree;
+//        BTree<int, std::less<int>, Pool_Allocator<int>, 512> tree;
+template<class T,
+         class Compare=std::less<T>,
+         class Alloc=std::allocator<T>,
+         std::size_t Node_Bytes=256
+        >
+class BTree : private Compare_Holder<Compare> {
+ private:
+    struct Node;
+    struct Internal_Node;
+    class iterator;
+
+    using Compare_Base = Compare_Holder<Compare>;
+    using Leaf_Alloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+    using Leaf_Alloc_Traits = std::allocator_traits<Leaf_Alloc>;
+    using Internal_Alloc = typename std::allocator_traits<Alloc>::
+        template rebind_alloc<Internal_Node>;
+    using Internal_Alloc_Traits = std::allocator_traits<Internal_Alloc>;
+    using Result_Pair = std::pair<iterator, bool>;
+
+ public:
+    using const_iterator = iterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    BTree() : m_root(nullptr), m_size(0) {};
+    explicit BTree(const Alloc& alloc)
+        : m_leaf_allocator(alloc), m_internal_allocator(alloc),
+          m_root(nullptr), m_size(0) {};
+    explicit BTree(const Compare& compare, const Alloc& alloc = Alloc())
+        : Compare_Base(compare), m_leaf_allocator(alloc),
+          m_internal_allocator(alloc), m_root(nullptr), m_size(0) {};
+    template<class InputIt>
+    BTree(InputIt first, InputIt last, const Alloc& alloc = Alloc())
+        : BTree(alloc) { insert(first, last); };
+    template<class InputIt>
+    BTree(InputIt first, InputIt last, const Compare& compare,
+          const Alloc& alloc = Alloc())
+        : BTree(compare, alloc) { insert(first, last); };
+    BTree(const BTree&);
+    BTree(BTree&&) noexcept;
+    ~BTree();
+
+    BTree& operator=(const BTree&);
+    BTree& operator=(BTree&&) noexcept;
+
+    // Replaces the content with [first, last)
+    template<class InputIt>
+    void assign(InputIt first, InputIt last);
+
+    Result_Pair insert(T&& insert_value)
+        { return m_insert(std::move(insert_value)); };
+    Result_Pair insert(const T& insert_value)
+        { return m_insert(insert_value); };
+    // The element is built first and dropped for a duplicate
+    template<class... Args>
+    Result_Pair emplace(Args&&... args)
+        { return m_insert(T(std::forward<Args>(args)...)); };
+    // For compatibility with Tree, the hint is not used:
+    // a descent costs only log_B(n) nodes
+    iterator insert(const_iterator, T&& insert_value)
+        { return m_insert(std::move(insert_value)).first; };
+    iterator insert(const_iterator, const T& insert_value)
+        { return m_insert(insert_value).first; };
+    template<class InputIt>
+    void insert(InputIt first, InputIt last);
+
+    // The element after the erased one is found again by its key,
+    // keys may have moved while the nodes were rebalanced
+    iterator erase(iterator position);
+    std::size_t erase(const T& key);
+    // with a transparent comparator every equivalent element is erased
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    std::size_t erase(const Key& key);
+
+    const_iterator find(const T& key) const { return m_find(key); };
+    bool contains(const T& key) const { return m_find(key) != end(); };
+    // first element not less than key
+    const_iterator lower_bound(const T& key) const
+        { return m_lower_bound(key); };
+    // first element greater than key
+    const_iterator upper_bound(const T& key) const
+        { return m_upper_bound(key); };
+    std::pair<const_iterator, const_iterator> equal_range(const T& key) const;
+    std::size_t count(const T& key) const { return contains(key); };
+
+    // Heterogeneous lookup with a transparent comparator (std::less<> etc.)
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    const_iterator find(const Key& key) const { return m_find(key); };
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    bool contains(const Key& key) const { return m_find(key) != end(); };
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    const_iterator lower_bound(const Key& key) const
+        { return m_lower_bound(key); };
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    const_iterator upper_bound(const Key& key) const
+        { return m_upper_bound(key); };
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    std::pair<const_iterator, const_iterator> equal_range(const Key& key) const
+        { return std::make_pair(m_lower_bound(key), m_upper_bound(key)); };
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    std::size_t count(const Key& key) const
+        { return std::distance(m_lower_bound(key), m_upper_bound(key)); };
+
+    std::size_t size() const { return m_size; };
+
+    Compare key_comp() const { return this->comparator(); };
+
+    // prints the keys node by node, level by level
+    void print();
+
+    // Different iterator getters
+    iterator begin() const;
+    const_iterator cbegin() const { return begin(); };
+    iterator end() const { return iterator(nullptr, 0, this); };
+    const_iterator cend() const { return end(); };
+    reverse_iterator rbegin() const
+        { return reverse_iterator(end()); };
+    const_reverse_iterator rcbegin() const
+        { return const_reverse_iterator(end()); };
+    reverse_iterator rend() const
+        { return reverse_iterator(begin()); };
+    const_reverse_iterator rcend() const
+        { return const_reverse_iterator(begin()); };
+
+    iterator before_end() const;
+
+ private:
+    // leaves and inner nodes have different sizes, so different allocators
+    Leaf_Alloc m_leaf_allocator;
+    Internal_Alloc m_internal_allocator;
+
+    Node* m_root;
+    std::size_t m_size;
+
+    // node fields before the keys
+    struct Node_Header {
+        void* parent;
+        std::uint16_t position;
+        std::uint16_t count;
+        bool leaf;
+    };
+
+    // Keys per node: as many as fit in Node_Bytes, at least 3.
+    // Nodes other than the root never have less than mc_min_keys.
+    static constexpr std::size_t mc_max_keys =
+        std::max<std::size_t>(3, (Node_Bytes - sizeof(Node_Header)) /
+                                 sizeof(T));
+    static constexpr std::size_t mc_min_keys = (mc_max_keys - 1) / 2;
+    static_assert(mc_max_keys < 0xFFFF, "Node_Bytes is too big for T");
+
+    // Arithmetic keys under plain < are searched in a node by counting
+    // (SIMD for 32 and 64-bit integers, see Key_Search.h), others by
+    // binary search
+    static constexpr bool mc_counted_search =
+        std::is_arithmetic<T>::value &&
+        (std::is_same<Compare, std::less<T>>::value ||
+         std::is_same<Compare, std::less<>>::value ||
+         std::is_same<Compare, Three_Way_Less>::value);
+
+    // Keys [0, count) are alive in the raw storage, the rest is not
+    // constructed. Leaves end with the keys, inner nodes add the children.
+    struct Node {
+        Internal_Node* parent;
+        std::uint16_t position; // index among the children of parent
+        std::uint16_t count;
+        bool leaf;
+
+        alignas(T) unsigned char storage[mc_max_keys * sizeof(T)];
+
+        explicit Node(bool leaf)
+            : parent(nullptr), position(0), count(0), leaf(leaf) {};
+
+        T* keys() { return std::launder(reinterpret_cast<T*>(storage)); };
+        const T* keys() const
+            { return std::launder(reinterpret_cast<const T*>(storage)); };
+    };
+
+    // child i holds the keys between keys[i - 1] and keys[i]
+    struct Internal_Node : Node {
+        Node* children[mc_max_keys + 1];
+
+        Internal_Node() : Node(false) {};
+    };
+
+    // Plain node and key index. Null node is both the past-the-end and
+    // the before-begin position: ++ from it gives begin(),
+    // -- gives before_end().
+    class iterator {
+     private:
+        friend class BTree;
+
+        Node* self;
+        std::size_t index;
+        const BTree* owner;
+
+     public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        iterator() : self(nullptr), index(0), owner(nullptr) {};
+        iterator(Node* init, std::size_t index,
+                 const BTree* owner)
+            : self(init), index(index), owner(owner) {};
+
+        // for LegacyIterator
+        const T& operator*() const { return self->keys()[index]; };
+        iterator& operator++();
+
+        // for LegacyInputIterator
+        bool operator==(const iterator& to_compare) const
+            { return self == to_compare.self && index == to_compare.index; };
+        bool operator!=(const iterator& to_compare) const
+            { return !(*this == to_compare); };
+        const T* operator->() const { return self->keys() + index; };
+        iterator operator++(int);
+
+        // for BidirectionalIterator
+        iterator& operator--();
+        iterator operator--(int);
+    };
+
+    static Internal_Node* m_internal(Node* node)
+        { return static_cast<Internal_Node*>(node); };
+    static const Internal_Node* m_internal(const Node* node)
+        { return static_cast<const Internal_Node*>(node); };
+
+    // in-node search: the first key not less (greater) than key,
+    // counted without branches for arithmetic keys
+    template<class Key>
+    std::size_t m_lower_bound_in(const Node* node, const Key& key) const;
+    template<class Key>
+    std::size_t m_upper_bound_in(const Node* node, const Key& key) const;
+
+    // lookups for T and transparently compared keys
+    template<class Key>
+    const_iterator m_find(const Key& key) const;
+    template<class Key>
+    const_iterator m_lower_bound(const Key& key) const;
+    template<class Key>
+    const_iterator m_upper_bound(const Key& key) const;
+
+    template<class InsType>
+    Result_Pair m_insert(InsType&& i_value);
+    // constructs the key at index, later keys shift right;
+    // the node must have room
+    template<class InsType>
+    void m_insert_key(Node* node, std::size_t index, InsType&& i_value);
+    // destroys the key at index, later keys shift left
+    void m_remove_key(Node* node, std::size_t index);
+    // splits a full node around its middle key, which goes up to the
+    // parent (splitting it first if it is full as well);
+    // returns the index the middle key had
+    std::size_t m_split(Node* node);
+
+    void m_erase_at(Node* node, std::size_t index);
+    // refills the node from a sibling or merges it with one,
+    // up the tree while nodes are under mc_min_keys
+    void m_rebalance(Node* node);
+    // move one key through the parent from left to its right neighbour
+    // node, or from right to its left neighbour node
+    void m_borrow_left(Node* left, Node* node);
+    void m_borrow_right(Node* node, Node* right);
+    // appends the separator and right to its left neighbour, frees right
+    void m_merge(Node* left, Node* right);
+
+    // node allocation through the rebound allocators
+    Node* m_create_leaf();
+    Internal_Node* m_create_internal();
+    // destroys the keys of the node and frees it
+    void m_destroy_node(Node*);
+    void m_destroy_subtree(Node*);
+    Node* m_copy_subtree(const Node* to_copy, Internal_Node* parent);
+    // children moved into node must learn their new place
+    static void m_adopt(Internal_Node* node, std::size_t first,
+                        std::size_t last);
+};
+
+
+// class BTree methods
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+BTree<T, Compare, Alloc, Node_Bytes>::BTree(const BTree& copy)
+    : Compare_Base(copy),
+      m_leaf_allocator(Leaf_Alloc_Traits::
+          select_on_container_copy_construction(copy.m_leaf_allocator)),
+      m_internal_allocator(Internal_Alloc_Traits::
+          select_on_container_copy_construction(copy.m_internal_allocator)),
+      m_root(nullptr), m_size(copy.m_size) {
+    if(copy.m_root) {
+        m_root = m_copy_subtree(copy.m_root, nullptr);
+    };
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+BTree<T, Compare, Alloc, Node_Bytes>::BTree(BTree&& other) noexcept
+    : Compare_Base(other),
+      m_leaf_allocator(std::move(other.m_leaf_allocator)),
+      m_internal_allocator(std::move(other.m_internal_allocator)),
+      m_root(other.m_root), m_size(other.m_size) {
+    other.m_root = nullptr;
+    other.m_size = 0;
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+BTree<T, Compare, Alloc, Node_Bytes>::~BTree() {
+    m_destroy_subtree(m_root);
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+BTree<T, Compare, Alloc, Node_Bytes>&
+BTree<T, Compare, Alloc, Node_Bytes>::operator=(const BTree& copy) {
+    if(this != &copy) {
+        m_destroy_subtree(m_root);
+        Compare_Base::operator=(copy);
+        m_root = nullptr;
+        m_size = 0;
+        if(copy.m_root) {
+            m_root = m_copy_subtree(copy.m_root, nullptr);
+        };
+        m_size = copy.m_size;
+    };
+    return *this;
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+BTree<T, Compare, Alloc, Node_Bytes>&
+BTree<T, Compare, Alloc, Node_Bytes>::operator=(BTree&& other) noexcept {
+    if(this != &other) {
+        m_destroy_subtree(m_root);
+        Compare_Base::operator=(other);
+        m_leaf_allocator = std::move(other.m_leaf_allocator);
+        m_internal_allocator = std::move(other.m_internal_allocator);
+        m_root = other.m_root;
+        m_size = other.m_size;
+        other.m_root = nullptr;
+        other.m_size = 0;
+    };
+    return *this;
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+template<class InputIt>
+void BTree<T, Compare, Alloc, Node_Bytes>::assign(InputIt first,
+                                                  InputIt last) {
+    m_destroy_subtree(m_root);
+    m_root = nullptr;
+    m_size = 0;
+    insert(first, last);
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+template<class InputIt>
+void BTree<T, Compare, Alloc, Node_Bytes>::insert(InputIt first,
+                                                  InputIt last) {
+    for(; first != last; ++first) {
+        m_insert(*first);
+    };
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+typename BTree<T, Compare, Alloc, Node_Bytes>::iterator
+BTree<T, Compare, Alloc, Node_Bytes>::erase(iterator position) {
+    T key(std::move(position.self->keys()[position.index]));
+    m_erase_at(position.self, position.index);
+    return m_lower_bound(key);
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+std::size_t BTree<T, Compare, Alloc, Node_Bytes>::erase(const T& key) {
+    iterator found = m_find(key);
+    if(found == end()) {
+        return 0;
+    };
+    m_erase_at(found.self, found.index);
+    return 1;
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+template<class Key, class C, class>
+std::size_t BTree<T, Compare, Alloc, Node_Bytes>::erase(const Key& key) {
+    std::size_t erased = 0;
+    for(iterator found = m_find(key); found != end(); found = m_find(key)) {
+        m_erase_at(found.self, found.index);
+        ++erased;
+    };
+    return erased;
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+auto
+BTree<T, Compare, Alloc, Node_Bytes>::equal_range(
+    const T& key) const -> std::pair<const_iterator, const_iterator> {
+    const_iterator lower = m_lower_bound(key);
+    const_iterator upper = lower;
+    if(lower != end() && !this->comparator()(key, *lower)) {
+        ++upper;
+    };
+    return std::make_pair(lower, upper);
+};
+
+// Binary search over the keys of one node, they share a few cache lines
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+template<class Key>
+std::size_t BTree<T, Compare, Alloc, Node_Bytes>::m_lower_bound_in(
+    const Node* node, const Key& key) const {
+    if constexpr(mc_counted_search && std::is_same<Key, T>::value) {
+        return count_less(node->keys(), node->count, key);
+    };
+    const Compare& compare = this->comparator();
+    const T* keys = node->keys();
+    std::size_t first = 0;
+    std::size_t count = node->count;
+    while(count > 0) {
+        std::size_t half = count / 2;
+        if(compare(keys[first + half], key)) {
+            first += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        };
+    };
+    return first;
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+template<class Key>
+std::size_t BTree<T, Compare, Alloc, Node_Bytes>::m_upper_bound_in(
+    const Node* node, const Key& key) const {
+    if constexpr(mc_counted_search && std::is_same<Key, T>::value) {
+        return count_not_greater(node->keys(), node->count, key);
+    };
+    const Compare& compare = this->comparator();
+    const T* keys = node->keys();
+    std::size_t first = 0;
+    std::size_t count = node->count;
+    while(count > 0) {
+        std::size_t half = count / 2;
+        if(!compare(key, keys[first + half])) {
+            first += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        };
+    };
+    return first;
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+template<class Key>
+typename BTree<T, Compare, Alloc, Node_Bytes>::const_iterator
+BTree<T, Compare, Alloc, Node_Bytes>::m_find(const Key& key) const {
+    const Compare& compare = this->comparator();
+    Node* node = m_root;
+    while(node) {
+        std::size_t index = m_lower_bound_in(node, key);
+        if(index < node->count && !compare(key, node->keys()[index])) {
+            return const_iterator(node, index, this);
+        };
+        if(node->leaf) {
+            break;
+        };
+        node = m_internal(node)->children[index];
+    };
+    return end();
+};
+
+// the answer is the deepest key met that is not less than key
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+template<class Key>
+typename BTree<T, Compare, Alloc, Node_Bytes>::const_iterator
+BTree<T, Compare, Alloc, Node_Bytes>::m_lower_bound(const Key& key) const {
+    const_iterator bound = end();
+    Node* node = m_root;
+    while(node) {
+        std::size_t index = m_lower_bound_in(node, key);
+        if(index < node->count) {
+            bound = const_iterator(node, index, this);
+        };
+        if(node->leaf) {
+            break;
+        };
+        node = m_internal(node)->children[index];
+    };
+    return bound;
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+template<class Key>
+typename BTree<T, Compare, Alloc, Node_Bytes>::const_iterator
+BTree<T, Compare, Alloc, Node_Bytes>::m_upper_bound(const Key& key) const {
+    const_iterator bound = end();
+    Node* node = m_root;
+    while(node) {
+        std::size_t index = m_upper_bound_in(node, key);
+        if(index < node->count) {
+            bound = const_iterator(node, index, this);
+        };
+        if(node->leaf) {
+            break;
+        };
+        node = m_internal(node)->children[index];
+    };
+    return bound;
+};
+
+// New keys always go to a leaf; a full leaf is split first, which
+// may split its ancestors up to the root
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+template<class InsType>
+typename BTree<T, Compare, Alloc, Node_Bytes>::Result_Pair
+BTree<T, Compare, Alloc, Node_Bytes>::m_insert(InsType&& i_value) {
+    if(!m_root) {
+        Node* leaf = m_create_leaf();
+        try {
+            m_insert_key(leaf, 0, std::forward<InsType>(i_value));
+        } catch(...) {
+            m_destroy_node(leaf);
+            throw;
+        };
+        m_root = leaf;
+        m_size = 1;
+        return Result_Pair(iterator(leaf, 0, this), true);
+    };
+
+    const Compare& compare = this->comparator();
+    Node* node = m_root;
+    std::size_t index;
+    while(true) {
+        index = m_lower_bound_in(node, i_value);
+        if(index < node->count && !compare(i_value, node->keys()[index])) {
+            return Result_Pair(iterator(node, index, this), false);
+        };
+        if(node->leaf) {
+            break;
+        };
+        node = m_internal(node)->children[index];
+    };
+
+    if(node->count == mc_max_keys) {
+        std::size_t middle = m_split(node);
+        // keys after the middle one went to the new right neighbour
+        if(index > middle) {
+            node = node->parent->children[node->position + 1];
+            index -= middle + 1;
+        };
+    };
+    m_insert_key(node, index, std::forward<InsType>(i_value));
+    ++m_size;
+    return Result_Pair(iterator(node, index, this), true);
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+template<class InsType>
+void BTree<T, Compare, Alloc, Node_Bytes>::m_insert_key(Node* node,
+                                                        std::size_t index,
+                                                        InsType&& i_value) {
+    T* keys = node->keys();
+    for(std::size_t i = node->count; i > index; --i) {
+        new(keys + i) T(std::move(keys[i - 1]));
+        keys[i - 1].~T();
+    };
+    try {
+        new(keys + index) T(std::forward<InsType>(i_value));
+    } catch(...) {
+        for(std::size_t i = index; i < node->count; ++i) {
+            new(keys + i) T(std::move(keys[i + 1]));
+            keys[i + 1].~T();
+        };
+        throw;
+    };
+    ++node->count;
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+void BTree<T, Compare, Alloc, Node_Bytes>::m_remove_key(Node* node,
+                                                        std::size_t index) {
+    T* keys = node->keys();
+    keys[index].~T();
+    for(std::size_t i = index + 1; i < node->count; ++i) {
+        new(keys + i - 1) T(std::move(keys[i]));
+        keys[i].~T();
+    };
+    --node->count;
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+std::size_t BTree<T, Compare, Alloc, Node_Bytes>::m_split(Node* node) {
+    // the parent needs room for the middle key,
+    // its split may move node under a new parent
+    if(node->parent && node->parent->count == mc_max_keys) {
+        m_split(node->parent);
+    };
+    Node* sibling = node->leaf ? m_create_leaf() : m_create_internal();
+    if(!node->parent) {
+        Internal_Node* root;
+        try {
+            root = m_create_internal();
+        } catch(...) {
+            m_destroy_node(sibling);
+            throw;
+        };
+        root->children[0] = node;
+        node->parent = root;
+        node->position = 0;
+        m_root = root;
+    };
+    Internal_Node* parent = node->parent;
+
+    std::size_t middle = node->count / 2;
+    T* keys = node->keys();
+    T* sibling_keys = sibling->keys();
+    for(std::size_t i = middle + 1; i < node->count; ++i) {
+        new(sibling_keys + i - middle - 1) T(std::move(keys[i]));
+        keys[i].~T();
+    };
+    sibling->count = node->count - middle - 1;
+    if(!node->leaf) {
+        Internal_Node* from = m_internal(node);
+        Internal_Node* to = m_internal(sibling);
+        for(std::size_t i = middle + 1; i <= node->count; ++i) {
+            to->children[i - middle - 1] = from->children[i];
+        };
+        m_adopt(to, 0, sibling->count);
+    };
+
+    // sibling becomes the next child of parent, the middle key
+    // separates the two
+    std::size_t position = node->position;
+    for(std::size_t i = parent->count; i > position; --i) {
+        parent->children[i + 1] = parent->children[i];
+    };
+    parent->children[position + 1] = sibling;
+    m_adopt(parent, position + 1, parent->count + 1);
+    node->count = middle + 1;
+    m_insert_key(parent, position, std::move(keys[middle]));
+    keys[middle].~T();
+    node->count = middle;
+    return middle;
+};
+
+// A key of an inner node is replaced by its predecessor, the last key
+// of the left subtree, so the actual removal is always from a leaf
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+void BTree<T, Compare, Alloc, Node_Bytes>::m_erase_at(Node* node,
+                                                      std::size_t index) {
+    if(!node->leaf) {
+        Node* leaf = m_internal(node)->children[index];
+        while(!leaf->leaf) {
+            leaf = m_internal(leaf)->children[leaf->count];
+        };
+        node->keys()[index] = std::move(leaf->keys()[leaf->count - 1]);
+        node = leaf;
+        index = leaf->count - 1;
+    };
+    m_remove_key(node, index);
+    --m_size;
+    m_rebalance(node);
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+void BTree<T, Compare, Alloc, Node_Bytes>::m_rebalance(Node* node) {
+    while(node != m_root && node->count < mc_min_keys) {
+        Internal_Node* parent = node->parent;
+        std::size_t position = node->position;
+        Node* left = (position > 0) ? parent->children[position - 1]
+                                    : nullptr;
+        Node* right = (position < parent->count)
+                      ? parent->children[position + 1] : nullptr;
+        if(left && left->count > mc_min_keys) {
+            m_borrow_left(left, node);
+            return;
+        };
+        if(right && right->count > mc_min_keys) {
+            m_borrow_right(node, right);
+            return;
+        };
+        if(left) {
+            m_merge(left, node);
+        } else {
+            m_merge(node, right);
+        };
+        node = parent;
+    };
+    // an emptied root gives way to its only child
+    if(m_root->count == 0) {
+        Node* old_root = m_root;
+        if(old_root->leaf) {
+            m_root = nullptr;
+        } else {
+            m_root = m_internal(old_root)->children[0];
+            m_root->parent = nullptr;
+            m_root->position = 0;
+        };
+        m_destroy_node(old_root);
+    };
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+void BTree<T, Compare, Alloc, Node_Bytes>::m_borrow_left(Node* left,
+                                                         Node* node) {
+    Internal_Node* parent = node->parent;
+    std::size_t separator = node->position - 1;
+    if(!node->leaf) {
+        Internal_Node* to = m_internal(node);
+        for(std::size_t i = node->count + 1; i > 0; --i) {
+            to->children[i] = to->children[i - 1];
+        };
+        to->children[0] = m_internal(left)->children[left->count];
+        m_adopt(to, 0, node->count + 1);
+    };
+    m_insert_key(node, 0, std::move(parent->keys()[separator]));
+    parent->keys()[separator] = std::move(left->keys()[left->count - 1]);
+    m_remove_key(left, left->count - 1);
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+void BTree<T, Compare, Alloc, Node_Bytes>::m_borrow_right(Node* node,
+                                                          Node* right) {
+    Internal_Node* parent = node->parent;
+    std::size_t separator = node->position;
+    m_insert_key(node, node->count, std::move(parent->keys()[separator]));
+    parent->keys()[separator] = std::move(right->keys()[0]);
+    if(!node->leaf) {
+        Internal_Node* to = m_internal(node);
+        Internal_Node* from = m_internal(right);
+        to->children[node->count] = from->children[0];
+        m_adopt(to, node->count, node->count);
+        for(std::size_t i = 0; i < right->count; ++i) {
+            from->children[i] = from->children[i + 1];
+        };
+        m_adopt(from, 0, right->count - 1);
+    };
+    m_remove_key(right, 0);
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+void BTree<T, Compare, Alloc, Node_Bytes>::m_merge(Node* left,
+                                                   Node* right) {
+    Internal_Node* parent = right->parent;
+    std::size_t separator = left->position;
+    m_insert_key(left, left->count, std::move(parent->keys()[separator]));
+    std::size_t offset = left->count;
+    T* keys = left->keys();
+    T* right_keys = right->keys();
+    for(std::size_t i = 0; i < right->count; ++i) {
+        new(keys + offset + i) T(std::move(right_keys[i]));
+        right_keys[i].~T();
+    };
+    if(!left->leaf) {
+        Internal_Node* to = m_internal(left);
+        Internal_Node* from = m_internal(right);
+        for(std::size_t i = 0; i <= right->count; ++i) {
+            to->children[offset + i] = from->children[i];
+        };
+        m_adopt(to, offset, offset + right->count);
+    };
+    left->count += right->count;
+    right->count = 0;
+
+    for(std::size_t i = separator + 1; i < parent->count; ++i) {
+        parent->children[i] = parent->children[i + 1];
+    };
+    m_adopt(parent, separator + 1, parent->count - 1);
+    m_remove_key(parent, separator);
+    m_destroy_node(right);
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+void BTree<T, Compare, Alloc, Node_Bytes>::m_adopt(Internal_Node* node,
+                                                   std::size_t first,
+                                                   std::size_t last) {
+    for(std::size_t i = first; i <= last; ++i) {
+        node->children[i]->parent = node;
+        node->children[i]->position = static_cast<std::uint16_t>(i);
+    };
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+typename BTree<T, Compare, Alloc, Node_Bytes>::Node*
+BTree<T, Compare, Alloc, Node_Bytes>::m_create_leaf() {
+    Node* node = Leaf_Alloc_Traits::allocate(m_leaf_allocator, 1);
+    Leaf_Alloc_Traits::construct(m_leaf_allocator, node, true);
+    return node;
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+typename BTree<T, Compare, Alloc, Node_Bytes>::Internal_Node*
+BTree<T, Compare, Alloc, Node_Bytes>::m_create_internal() {
+    Internal_Node* node =
+        Internal_Alloc_Traits::allocate(m_internal_allocator, 1);
+    Internal_Alloc_Traits::construct(m_internal_allocator, node);
+    return node;
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+void BTree<T, Compare, Alloc, Node_Bytes>::m_destroy_node(Node* node) {
+    T* keys = node->keys();
+    for(std::size_t i = 0; i < node->count; ++i) {
+        keys[i].~T();
+    };
+    if(node->leaf) {
+        Leaf_Alloc_Traits::destroy(m_leaf_allocator, node);
+        Leaf_Alloc_Traits::deallocate(m_leaf_allocator, node, 1);
+    } else {
+        Internal_Node* internal = m_internal(node);
+        Internal_Alloc_Traits::destroy(m_internal_allocator, internal);
+        Internal_Alloc_Traits::deallocate(m_internal_allocator, internal, 1);
+    };
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+void BTree<T, Compare, Alloc, Node_Bytes>::m_destroy_subtree(Node* node) {
+    if(node) {
+        if(!node->leaf) {
+            for(std::size_t i = 0; i <= node->count; ++i) {
+                m_destroy_subtree(m_internal(node)->children[i]);
+            };
+        };
+        m_destroy_node(node);
+    };
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+typename BTree<T, Compare, Alloc, Node_Bytes>::Node*
+BTree<T, Compare, Alloc, Node_Bytes>::m_copy_subtree(const Node* to_copy,
+                                                     Internal_Node* parent) {
+    Node* ret = to_copy->leaf ? m_create_leaf() : m_create_internal();
+    ret->parent = parent;
+    ret->position = to_copy->position;
+    try {
+        const T* keys = to_copy->keys();
+        for(; ret->count < to_copy->count; ++ret->count) {
+            new(ret->keys() + ret->count) T(keys[ret->count]);
+        };
+        if(!to_copy->leaf) {
+            Internal_Node* internal = m_internal(ret);
+            // children the copy failed to reach are not destroyed
+            std::size_t copied = 0;
+            try {
+                for(; copied <= to_copy->count; ++copied) {
+                    internal->children[copied] = m_copy_subtree(
+                        m_internal(to_copy)->children[copied], internal);
+                };
+            } catch(...) {
+                for(std::size_t i = 0; i < copied; ++i) {
+                    m_destroy_subtree(internal->children[i]);
+                };
+                throw;
+            };
+        };
+    } catch(...) {
+        m_destroy_node(ret);
+        throw;
+    };
+    return ret;
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+void BTree<T, Compare, Alloc, Node_Bytes>::print() {
+    std::deque<Node*> queue;
+    if(m_root) {
+        queue.push_back(m_root);
+    };
+    Node* temp_p;
+    while(!queue.empty()) {
+        temp_p = queue.front();
+        queue.pop_front();
+        std::cout << "[";
+        for(std::size_t i = 0; i < temp_p->count; ++i) {
+            std::cout << (i ? " " : "") << temp_p->keys()[i];
+        };
+        std::cout << "] ";
+        if(!temp_p->leaf) {
+            for(std::size_t i = 0; i <= temp_p->count; ++i) {
+                queue.push_back(m_internal(temp_p)->children[i]);
+            };
+        };
+    };
+};
+
+// Begin and rbegin iterator getters
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+typename BTree<T, Compare, Alloc, Node_Bytes>::iterator
+BTree<T, Compare, Alloc, Node_Bytes>::begin() const {
+    Node* node = m_root;
+    if(!node) {
+        return end();
+    };
+    while(!node->leaf) {
+        node = m_internal(node)->children[0];
+    };
+    return iterator(node, 0, this);
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+typename BTree<T, Compare, Alloc, Node_Bytes>::iterator
+BTree<T, Compare, Alloc, Node_Bytes>::before_end() const {
+    Node* node = m_root;
+    if(!node) {
+        return end();
+    };
+    while(!node->leaf) {
+        node = m_internal(node)->children[node->count];
+    };
+    return iterator(node, node->count - 1, this);
+};
+
+
+// class BTree<T>::iterator methods
+
+// for LegacyIterator
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+typename BTree<T, Compare, Alloc, Node_Bytes>::iterator&
+BTree<T, Compare, Alloc, Node_Bytes>::iterator::operator++() {
+    if(!self) {
+        *this = owner->begin();
+        return *this;
+    };
+    if(!self->leaf) {
+        // the leftmost key of the subtree right of the current key
+        Node* temp = m_internal(self)->children[index + 1];
+        while(!temp->leaf) {
+            temp = m_internal(temp)->children[0];
+        };
+        self = temp;
+        index = 0;
+    } else if(index + 1 < self->count) {
+        ++index;
+    } else {
+        // climbing out of the root gives the null past-the-end node
+        Node* temp = self;
+        while(temp->parent && temp->position == temp->parent->count) {
+            temp = temp->parent;
+        };
+        index = temp->parent ? temp->position : 0;
+        self = temp->parent;
+    };
+    return *this;
+};
+
+// for LegacyInputIterator
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+typename BTree<T, Compare, Alloc, Node_Bytes>::iterator
+BTree<T, Compare, Alloc, Node_Bytes>::iterator::operator++(int) {
+    iterator temp = *this;
+    ++(*this);
+    return temp;
+};
+
+// for BidirectionalIterator
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+typename BTree<T, Compare, Alloc, Node_Bytes>::iterator&
+BTree<T, Compare, Alloc, Node_Bytes>::iterator::operator--() {
+    if(!self) {
+        *this = owner->before_end();
+        return *this;
+    };
+    if(!self->leaf) {
+        // the rightmost key of the subtree left of the current key
+        Node* temp = m_internal(self)->children[index];
+        while(!temp->leaf) {
+            temp = m_internal(temp)->children[temp->count];
+        };
+        self = temp;
+        index = temp->count - 1;
+    } else if(index > 0) {
+        --index;
+    } else {
+        // climbing out of the root gives the null before-begin node
+        Node* temp = self;
+        while(temp->parent && temp->position == 0) {
+            temp = temp->parent;
+        };
+        index = temp->parent ? temp->position - 1 : 0;
+        self = temp->parent;
+    };
+    return *this;
+};
+
+template<class T, class Compare, class Alloc, std::size_t Node_Bytes>
+typename BTree<T, Compare, Alloc, Node_Bytes>::iterator
+BTree<T, Compare, Alloc, Node_Bytes>::iterator::operator--(int) {
+    iterator temp = *this;
+    --(*this);
+    return temp;
+};
@@ -0,0 +1,132 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <shared_mutex>
+#include <mutex>
+
+#include "Tree.cpp"
+#include "Concurrent_Tree.h"
+
+// Scalability benchmark of Concurrent_Tree: throughput of a mix of
+// contains / insert / erase on random keys for 1 to 64 threads, against
+// Tree behind one reader-writer lock.
+// Half of the key range is inserted first and inserts and erases come in
+// equal numbers, so the size stays about the same.
+
+class Timer
+{
+private:
+    std::chrono::steady_clock::time_point start;
+
+public:
+    Timer() : start(std::chrono::steady_clock::now()) { }
+
+    void reset()
+    {
+        start = std::chrono::steady_clock::now();
+    }
+
+    double elapsed() const
+    {
+        return std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1> >>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+// Tree with one lock, the baseline
+class Locked_Tree
+{
+private:
+    Tree<int> tree;
+    mutable std::shared_mutex lock;
+
+public:
+    bool insert(int key)
+    {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        return tree.insert(key).second;
+    }
+
+    bool erase(int key)
+    {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        return tree.erase(key);
+    }
+
+    bool contains(int key) const
+    {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        return tree.contains(key);
+    }
+};
+
+// millions of operations per second; read_percent of the operations are
+// contains, the rest half insert and half erase
+template<class Set>
+double run(int threads, int read_percent, int key_range, int operations)
+{
+    Set set;
+    std::mt19937 mersenne(1);
+    for (int i = 0; i < key_range / 2; i += 1) {
+        set.insert(mersenne() % key_range);
+    }
+
+    std::vector<std::thread> workers;
+    int per_thread = operations / threads;
+    Timer timer;
+    for (int t = 0; t < threads; t += 1) {
+        workers.emplace_back([&set, t, per_thread, read_percent, key_range]() {
+            std::mt19937 mersenne(t + 2);
+            int found = 0;
+            for (int i = 0; i < per_thread; i += 1) {
+                int key = mersenne() % key_range;
+                int op = mersenne() % 100;
+                if (op < read_percent) {
+                    found += set.contains(key);
+                } else if ((op - read_percent) % 2 == 0) {
+                    set.insert(key);
+                } else {
+                    set.erase(key);
+                }
+            }
+            volatile int sink = found;
+            (void)sink;
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return per_thread * double(threads) / timer.elapsed() / 1e6;
+}
+
+int main() {
+    std::cout << "Enter the range of keys: ";
+    int key_range;
+    std::cin >> key_range;
+    std::cout << "Enter the number of operations per test: ";
+    int operations;
+    std::cin >> operations;
+
+    std::cout << "hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "Mops/s, Concurrent_Tree / Tree with a shared_mutex" << std::endl;
+    std::cout << std::setw(8) << "threads";
+    const int read_percents[] = {100, 90, 50, 0};
+    for (int read_percent : read_percents) {
+        std::cout << std::setw(16) << (std::to_string(read_percent) + "% reads");
+    }
+    std::cout << std::endl;
+
+    for (int threads = 1; threads <= 64; threads *= 2) {
+        std::cout << std::setw(8) << threads << std::fixed << std::setprecision(2);
+        for (int read_percent : read_percents) {
+            double concurrent = run<Concurrent_Tree<int>>(threads, read_percent, key_range, operations);
+            double locked = run<Locked_Tree>(threads, read_percent, key_range, operations);
+            std::cout << std::setw(9) << concurrent << " / " << std::setw(4) << locked;
+        }
+        std::cout << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,1045 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "Three_Way.h"
+
+
+// Concurrent AVL set after Bronson, Casper, Chafi and Olukotun,
+// "A Practical Concurrent Binary Search Tree" (PPoPP 2010).
+// Any number of threads may insert, erase and look up at the same time.
+// - Lookups take no locks. Every node has a version that a rotation
+//   marks as shrinking before it moves the node down and bumps after;
+//   a reader checks the version of the node it came from before going
+//   on (hand-over-hand), and retries from there if the version moved.
+// - Writers lock only the nodes they change, parent before child.
+// - Erasing a node with two children just marks it absent, it stays as
+//   a routing node until it has at most one child and is unlinked.
+// - Balance is relaxed: heights are fixed and rotations done bottom-up
+//   after each change, under the locks of the nodes involved.
+// Unlinked nodes may still be read by lookups in flight, so they are
+// freed by epochs: every operation pins a slot with the epoch it began
+// in, a writer keeps the nodes it unlinks in its slot with the epoch of
+// the unlink, and frees them once every pinned slot is past that epoch.
+// A thread stalled inside an operation holds back the nodes unlinked
+// since it started, nothing else grows.
+// The allocator is called concurrently and must be thread-safe
+// (std::allocator is, Pool_Allocator is not).
+//
+// Usage: Concurrent_Tree<int> tree;   // shared by the threads
+//        tree.insert(5); tree.contains(5); tree.erase(5);
+template<class T,
+         class Compare=std::less<T>,
+         class Alloc=std::allocator<T>
+        >
+class Concurrent_Tree : private Compare_Holder<Compare> {
+ private:
+    struct Node_Base;
+    struct Node;
+
+    using Compare_Base = Compare_Holder<Compare>;
+    using Node_Alloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+    using Node_Alloc_Traits = std::allocator_traits<Node_Alloc>;
+
+ public:
+    Concurrent_Tree() : m_size(0) {};
+    explicit Concurrent_Tree(const Compare& compare,
+                             const Alloc& alloc = Alloc())
+        : Compare_Base(compare), m_node_allocator(alloc), m_size(0) {};
+    Concurrent_Tree(const Concurrent_Tree&) = delete;
+    Concurrent_Tree& operator=(const Concurrent_Tree&) = delete;
+    ~Concurrent_Tree();
+
+    // true if the key was missing and is inserted now
+    bool insert(const T& key) { return m_update(key, true); };
+    // true if the key was there and is erased now
+    bool erase(const T& key) { return m_update(key, false); };
+    // lock-free unless it meets a rotation in progress
+    bool contains(const T& key) const { return m_contains(key); };
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    bool contains(const Key& key) const { return m_contains(key); };
+
+    // number of keys, exact once concurrent changes are over
+    std::size_t size() const { return m_size.load(); };
+
+    Compare key_comp() const { return this->comparator(); };
+
+    // Calls f(key) in ascending order. Not safe with concurrent writers.
+    template<class Function>
+    void for_each(Function&& f) const;
+
+    // Frees all unlinked nodes now, those still waiting for their epoch
+    // too. Not safe with any concurrent operation.
+    void collect();
+
+ private:
+    // The tree hangs off m_holder.right; the holder has no key and is
+    // never compared with
+    struct Node_Base {
+        std::atomic<int> height{1};
+        // false for a routing node (and the holder)
+        std::atomic<bool> present{false};
+        std::atomic<Node_Base*> parent{nullptr};
+        std::atomic<Node_Base*> left{nullptr};
+        std::atomic<Node_Base*> right{nullptr};
+        // mc_unlinked, or mc_shrinking and a count of finished shrinks
+        std::atomic<std::uint64_t> version{0};
+        std::atomic<bool> locked{false};
+
+        std::atomic<Node_Base*>& child(int order)
+            { return (order < 0) ? left : right; };
+    };
+
+    struct Node : Node_Base {
+        const T key;
+
+        Node(const T& key, Node_Base* parent) : key(key) {
+            this->present.store(true);
+            this->parent.store(parent);
+        };
+    };
+
+    // Holds the lock of a node for a scope
+    class Node_Guard {
+     public:
+        explicit Node_Guard(Node_Base* node);
+        Node_Guard(const Node_Guard&) = delete;
+        Node_Guard& operator=(const Node_Guard&) = delete;
+        ~Node_Guard()
+            { m_node->locked.store(false, std::memory_order_release); };
+
+     private:
+        Node_Base* m_node;
+    };
+
+    // outcome of one optimistic attempt
+    enum class Attempt { no, yes, retry };
+
+    static constexpr std::uint64_t mc_unlinked = 1;
+    static constexpr std::uint64_t mc_shrinking = 2;
+    static bool m_is_unlinked(std::uint64_t version)
+        { return version & mc_unlinked; };
+    static bool m_is_changing(std::uint64_t version)
+        { return version & (mc_unlinked | mc_shrinking); };
+    static std::uint64_t m_begin_shrink(std::uint64_t version)
+        { return version | mc_shrinking; };
+    // clears the flags and counts one more shrink
+    static std::uint64_t m_end_shrink(std::uint64_t version)
+        { return (version | mc_unlinked | mc_shrinking) + 1; };
+    // spins, then yields, while a rotation moves node down
+    static void m_wait_until_not_changing(Node_Base* node);
+    // spins before yielding, while waiting for a lock or a rotation
+    static constexpr int mc_spins = 64;
+
+    // results of m_condition other than a new height
+    static constexpr int mc_unlink_required = -1;
+    static constexpr int mc_rebalance_required = -2;
+    static constexpr int mc_nothing_required = -3;
+
+    Node_Alloc m_node_allocator;
+    mutable Node_Base m_holder;
+    std::atomic<std::size_t> m_size;
+
+    // An operation holds one slot, found from a hash of the thread id,
+    // so a thread mostly keeps its slot and its cache line
+    struct alignas(64) Epoch_Slot {
+        // 0 when free, otherwise the epoch its holder began in
+        std::atomic<std::uint64_t> epoch{0};
+        // nodes unlinked by holders of the slot, with the epoch then
+        std::vector<std::pair<Node*, std::uint64_t>> retired;
+        // retired size that triggers the next m_reclaim
+        std::size_t reclaim_at = mc_reclaim_batch;
+    };
+
+    // Pins a slot for one operation; a writer reclaims on the way out
+    class Epoch_Guard {
+     public:
+        explicit Epoch_Guard(const Concurrent_Tree* tree);
+        explicit Epoch_Guard(Concurrent_Tree* tree);
+        Epoch_Guard(const Epoch_Guard&) = delete;
+        Epoch_Guard& operator=(const Epoch_Guard&) = delete;
+        ~Epoch_Guard();
+
+     private:
+        Concurrent_Tree* m_writer;
+        Epoch_Slot* m_slot;
+        Epoch_Slot* m_previous;
+    };
+
+    // more operations at once wait for a free slot
+    static constexpr std::size_t mc_slots = 128;
+    static constexpr std::size_t mc_reclaim_batch = 64;
+
+    mutable std::atomic<std::uint64_t> m_epoch{1};
+    std::unique_ptr<Epoch_Slot[]> m_slots{new Epoch_Slot[mc_slots]};
+    // the slot of the operation running on this thread, for m_retire
+    static inline thread_local Epoch_Slot* m_current_slot = nullptr;
+
+    static const T& m_key(Node_Base* node)
+        { return static_cast<Node*>(node)->key; };
+    static int m_height(Node_Base* node)
+        { return node ? node->height.load() : 0; };
+    template<class A, class B>
+    int m_three_way(const A& a, const B& b) const
+        { return three_way_compare(this->comparator(), a, b); };
+
+    template<class Key>
+    bool m_contains(const Key& key) const;
+    // looks for key below node, reached with version, in direction order
+    template<class Key>
+    Attempt m_attempt_get(const Key& key, Node_Base* node, int order,
+                          std::uint64_t version) const;
+
+    bool m_update(const T& key, bool insert);
+    Attempt m_attempt_update(const T& key, bool insert, Node_Base* parent,
+                             Node_Base* node, std::uint64_t version);
+    // node holds key: makes it present or absent
+    Attempt m_attempt_node_update(bool insert, Node_Base* parent,
+                                  Node_Base* node);
+
+    // The _nl functions expect the nodes they change locked and return
+    // the next node needing repair, or nullptr
+
+    // replaces the node (with at most one child) by its child
+    bool m_attempt_unlink_nl(Node_Base* parent, Node_Base* node);
+    // new height of node, or what else it needs
+    int m_condition(Node_Base* node) const;
+    Node_Base* m_fix_height_nl(Node_Base* node);
+    void m_fix_height_and_rebalance(Node_Base* node);
+    Node_Base* m_rebalance_nl(Node_Base* parent, Node_Base* node);
+    Node_Base* m_rebalance_to_right_nl(Node_Base* parent, Node_Base* node,
+                                       Node_Base* left, int right_h);
+    Node_Base* m_rebalance_to_left_nl(Node_Base* parent, Node_Base* node,
+                                      Node_Base* right, int left_h);
+    Node_Base* m_rotate_right_nl(Node_Base* parent, Node_Base* node,
+                                 Node_Base* left, int right_h,
+                                 int left_left_h, Node_Base* left_right,
+                                 int left_right_h);
+    Node_Base* m_rotate_left_nl(Node_Base* parent, Node_Base* node,
+                                int left_h, Node_Base* right,
+                                Node_Base* right_left, int right_left_h,
+                                int right_right_h);
+    Node_Base* m_rotate_right_over_left_nl(Node_Base* parent,
+                                           Node_Base* node,
+                                           Node_Base* left, int right_h,
+                                           int left_left_h,
+                                           Node_Base* left_right,
+                                           int left_right_left_h);
+    Node_Base* m_rotate_left_over_right_nl(Node_Base* parent,
+                                           Node_Base* node, int left_h,
+                                           Node_Base* right,
+                                           Node_Base* right_left,
+                                           int right_right_h,
+                                           int right_left_right_h);
+
+    Node* m_create_node(const T& key, Node_Base* parent);
+    void m_destroy_node(Node* node);
+    void m_destroy_subtree(Node_Base* node);
+    // puts an unlinked node in the current slot
+    void m_retire(Node_Base* node);
+    Epoch_Slot* m_pin() const;
+    // Frees the nodes of slot that no pinned operation can reach, and
+    // moves the epoch on when every pinned one has seen it
+    void m_reclaim(Epoch_Slot* slot);
+    template<class Function>
+    static void m_for_each(Node_Base* node, Function& f);
+};
+
+
+// class Concurrent_Tree methods
+
+template<class T, class Compare, class Alloc>
+Concurrent_Tree<T, Compare, Alloc>::~Concurrent_Tree() {
+    m_destroy_subtree(m_holder.right.load());
+    collect();
+};
+
+template<class T, class Compare, class Alloc>
+void Concurrent_Tree<T, Compare, Alloc>::collect() {
+    for(std::size_t i = 0; i < mc_slots; ++i) {
+        for(const auto& retired : m_slots[i].retired) {
+            m_destroy_node(retired.first);
+        };
+        m_slots[i].retired.clear();
+        m_slots[i].reclaim_at = mc_reclaim_batch;
+    };
+};
+
+template<class T, class Compare, class Alloc>
+template<class Function>
+void Concurrent_Tree<T, Compare, Alloc>::for_each(Function&& f) const {
+    m_for_each(m_holder.right.load(), f);
+};
+
+template<class T, class Compare, class Alloc>
+template<class Function>
+void Concurrent_Tree<T, Compare, Alloc>::m_for_each(Node_Base* node,
+                                                    Function& f) {
+    if(node) {
+        m_for_each(node->left.load(), f);
+        if(node->present.load()) {
+            f(m_key(node));
+        };
+        m_for_each(node->right.load(), f);
+    };
+};
+
+template<class T, class Compare, class Alloc>
+Concurrent_Tree<T, Compare, Alloc>::Node_Guard::Node_Guard(Node_Base* node)
+    : m_node(node) {
+    int spins = 0;
+    while(m_node->locked.exchange(true, std::memory_order_acquire)) {
+        while(m_node->locked.load(std::memory_order_relaxed)) {
+            if(++spins > mc_spins) {
+                std::this_thread::yield();
+            };
+        };
+    };
+};
+
+template<class T, class Compare, class Alloc>
+void Concurrent_Tree<T, Compare, Alloc>::m_wait_until_not_changing(
+    Node_Base* node) {
+    std::uint64_t version = node->version.load();
+    if(version & mc_shrinking) {
+        int spins = 0;
+        while(node->version.load() == version) {
+            if(++spins > mc_spins) {
+                std::this_thread::yield();
+            };
+        };
+    };
+};
+
+template<class T, class Compare, class Alloc>
+template<class Key>
+bool Concurrent_Tree<T, Compare, Alloc>::m_contains(const Key& key) const {
+    Epoch_Guard guard(this);
+    while(true) {
+        Node_Base* right = m_holder.right.load();
+        if(!right) {
+            return false;
+        };
+        int order = m_three_way(key, m_key(right));
+        if(order == 0) {
+            return right->present.load();
+        };
+        std::uint64_t version = right->version.load();
+        if(m_is_changing(version)) {
+            m_wait_until_not_changing(right);
+        } else if(right == m_holder.right.load()) {
+            Attempt found = m_attempt_get(key, right, order, version);
+            if(found != Attempt::retry) {
+                return found == Attempt::yes;
+            };
+        };
+    };
+};
+
+// A child read while node still has the same version was in the right
+// place at that moment. A retry goes back only to the caller, whose
+// node version is still valid.
+template<class T, class Compare, class Alloc>
+template<class Key>
+typename Concurrent_Tree<T, Compare, Alloc>::Attempt
+Concurrent_Tree<T, Compare, Alloc>::m_attempt_get(
+    const Key& key, Node_Base* node, int order,
+    std::uint64_t version) const {
+    while(true) {
+        Node_Base* child = node->child(order).load();
+        if(!child) {
+            return (node->version.load() != version) ? Attempt::retry
+                                                     : Attempt::no;
+        };
+        int child_order = m_three_way(key, m_key(child));
+        if(child_order == 0) {
+            return child->present.load() ? Attempt::yes : Attempt::no;
+        };
+        std::uint64_t child_version = child->version.load();
+        if(m_is_changing(child_version)) {
+            m_wait_until_not_changing(child);
+            if(node->version.load() != version) {
+                return Attempt::retry;
+            };
+        } else if(child != node->child(order).load()) {
+            if(node->version.load() != version) {
+                return Attempt::retry;
+            };
+        } else {
+            if(node->version.load() != version) {
+                return Attempt::retry;
+            };
+            Attempt found = m_attempt_get(key, child, child_order,
+                                          child_version);
+            if(found != Attempt::retry) {
+                return found;
+            };
+        };
+    };
+};
+
+template<class T, class Compare, class Alloc>
+bool Concurrent_Tree<T, Compare, Alloc>::m_update(const T& key,
+                                                  bool insert) {
+    Epoch_Guard guard(this);
+    while(true) {
+        Node_Base* right = m_holder.right.load();
+        if(!right) {
+            if(!insert) {
+                return false;
+            };
+            Node_Guard guard(&m_holder);
+            if(!m_holder.right.load()) {
+                m_holder.right.store(m_create_node(key, &m_holder));
+                ++m_size;
+                return true;
+            };
+        } else {
+            std::uint64_t version = right->version.load();
+            if(m_is_changing(version)) {
+                m_wait_until_not_changing(right);
+            } else if(right == m_holder.right.load()) {
+                Attempt done = m_attempt_update(key, insert, &m_holder,
+                                                right, version);
+                if(done != Attempt::retry) {
+                    return done == Attempt::yes;
+                };
+            };
+        };
+    };
+};
+
+template<class T, class Compare, class Alloc>
+typename Concurrent_Tree<T, Compare, Alloc>::Attempt
+Concurrent_Tree<T, Compare, Alloc>::m_attempt_update(
+    const T& key, bool insert, Node_Base* parent, Node_Base* node,
+    std::uint64_t version) {
+    int order = m_three_way(key, m_key(node));
+    if(order == 0) {
+        return m_attempt_node_update(insert, parent, node);
+    };
+    while(true) {
+        Node_Base* child = node->child(order).load();
+        if(node->version.load() != version) {
+            return Attempt::retry;
+        };
+        if(!child) {
+            if(!insert) {
+                return Attempt::no;
+            };
+            Node_Base* damaged;
+            {
+                Node_Guard guard(node);
+                if(node->version.load() != version) {
+                    return Attempt::retry;
+                };
+                // lost a race for the place, look again
+                if(node->child(order).load()) {
+                    continue;
+                };
+                node->child(order).store(m_create_node(key, node));
+                damaged = m_fix_height_nl(node);
+            };
+            ++m_size;
+            m_fix_height_and_rebalance(damaged);
+            return Attempt::yes;
+        };
+        std::uint64_t child_version = child->version.load();
+        if(m_is_changing(child_version)) {
+            m_wait_until_not_changing(child);
+        } else if(child == node->child(order).load()) {
+            if(node->version.load() != version) {
+                return Attempt::retry;
+            };
+            Attempt done = m_attempt_update(key, insert, node, child,
+                                            child_version);
+            if(done != Attempt::retry) {
+                return done;
+            };
+        };
+    };
+};
+
+template<class T, class Compare, class Alloc>
+typename Concurrent_Tree<T, Compare, Alloc>::Attempt
+Concurrent_Tree<T, Compare, Alloc>::m_attempt_node_update(
+    bool insert, Node_Base* parent, Node_Base* node) {
+    if(insert) {
+        if(node->present.load()) {
+            return Attempt::no;
+        };
+        // a routing node becomes a key again, unless it got unlinked
+        Node_Guard guard(node);
+        if(m_is_unlinked(node->version.load())) {
+            return Attempt::retry;
+        };
+        if(node->present.load()) {
+            return Attempt::no;
+        };
+        node->present.store(true);
+        ++m_size;
+        return Attempt::yes;
+    };
+
+    if(!node->present.load()) {
+        return Attempt::no;
+    };
+    if(node->left.load() && node->right.load()) {
+        // two children: node stays as a routing node
+        Node_Guard guard(node);
+        if(m_is_unlinked(node->version.load()) ||
+           !node->left.load() || !node->right.load()) {
+            return Attempt::retry;
+        };
+        if(!node->present.load()) {
+            return Attempt::no;
+        };
+        node->present.store(false);
+        --m_size;
+        return Attempt::yes;
+    };
+
+    Node_Base* damaged;
+    {
+        Node_Guard parent_guard(parent);
+        if(m_is_unlinked(parent->version.load()) ||
+           node->parent.load() != parent) {
+            return Attempt::retry;
+        };
+        {
+            Node_Guard guard(node);
+            if(!node->present.load()) {
+                return Attempt::no;
+            };
+            if(!m_attempt_unlink_nl(parent, node)) {
+                return Attempt::retry;
+            };
+        };
+        damaged = m_fix_height_nl(parent);
+    };
+    --m_size;
+    m_fix_height_and_rebalance(damaged);
+    return Attempt::yes;
+};
+
+template<class T, class Compare, class Alloc>
+bool Concurrent_Tree<T, Compare, Alloc>::m_attempt_unlink_nl(
+    Node_Base* parent, Node_Base* node) {
+    Node_Base* parent_left = parent->left.load();
+    Node_Base* parent_right = parent->right.load();
+    if(parent_left != node && parent_right != node) {
+        return false;
+    };
+    Node_Base* left = node->left.load();
+    Node_Base* right = node->right.load();
+    if(left && right) {
+        return false;
+    };
+    Node_Base* splice = left ? left : right;
+    if(parent_left == node) {
+        parent->left.store(splice);
+    } else {
+        parent->right.store(splice);
+    };
+    if(splice) {
+        splice->parent.store(parent);
+    };
+    node->version.store(mc_unlinked);
+    node->present.store(false);
+    m_retire(node);
+    return true;
+};
+
+template<class T, class Compare, class Alloc>
+int Concurrent_Tree<T, Compare, Alloc>::m_condition(Node_Base* node) const {
+    Node_Base* left = node->left.load();
+    Node_Base* right = node->right.load();
+    if((!left || !right) && !node->present.load()) {
+        return mc_unlink_required;
+    };
+    int height = node->height.load();
+    int left_h = m_height(left);
+    int right_h = m_height(right);
+    int new_height = 1 + std::max(left_h, right_h);
+    int balance = left_h - right_h;
+    if(balance < -1 || balance > 1) {
+        return mc_rebalance_required;
+    };
+    return (height != new_height) ? new_height : mc_nothing_required;
+};
+
+template<class T, class Compare, class Alloc>
+typename Concurrent_Tree<T, Compare, Alloc>::Node_Base*
+Concurrent_Tree<T, Compare, Alloc>::m_fix_height_nl(Node_Base* node) {
+    int condition = m_condition(node);
+    switch(condition) {
+        case mc_rebalance_required:
+        case mc_unlink_required:
+            return node;
+        case mc_nothing_required:
+            return nullptr;
+        default:
+            node->height.store(condition);
+            return node->parent.load();
+    };
+};
+
+// Works up from node while something needs repair; the holder (no
+// parent) ends it
+template<class T, class Compare, class Alloc>
+void Concurrent_Tree<T, Compare, Alloc>::m_fix_height_and_rebalance(
+    Node_Base* node) {
+    while(node && node->parent.load()) {
+        int condition = m_condition(node);
+        if(condition == mc_nothing_required ||
+           m_is_unlinked(node->version.load())) {
+            return;
+        };
+        if(condition != mc_unlink_required &&
+           condition != mc_rebalance_required) {
+            Node_Guard guard(node);
+            node = m_fix_height_nl(node);
+        } else {
+            Node_Base* parent = node->parent.load();
+            Node_Guard parent_guard(parent);
+            if(!m_is_unlinked(parent->version.load()) &&
+               node->parent.load() == parent) {
+                Node_Guard guard(node);
+                node = m_rebalance_nl(parent, node);
+            };
+        };
+    };
+};
+
+template<class T, class Compare, class Alloc>
+typename Concurrent_Tree<T, Compare, Alloc>::Node_Base*
+Concurrent_Tree<T, Compare, Alloc>::m_rebalance_nl(Node_Base* parent,
+                                                   Node_Base* node) {
+    Node_Base* left = node->left.load();
+    Node_Base* right = node->right.load();
+    if((!left || !right) && !node->present.load()) {
+        if(m_attempt_unlink_nl(parent, node)) {
+            return m_fix_height_nl(parent);
+        };
+        return node;
+    };
+    int height = node->height.load();
+    int left_h = m_height(left);
+    int right_h = m_height(right);
+    int new_height = 1 + std::max(left_h, right_h);
+    int balance = left_h - right_h;
+    if(balance > 1) {
+        return m_rebalance_to_right_nl(parent, node, left, right_h);
+    } else if(balance < -1) {
+        return m_rebalance_to_left_nl(parent, node, right, left_h);
+    } else if(new_height != height) {
+        node->height.store(new_height);
+        return m_fix_height_nl(parent);
+    } else {
+        return nullptr;
+    };
+};
+
+// Left side too high: a single rotation, or a double one if the inner
+// grandchild is the higher; returning node means try again
+template<class T, class Compare, class Alloc>
+typename Concurrent_Tree<T, Compare, Alloc>::Node_Base*
+Concurrent_Tree<T, Compare, Alloc>::m_rebalance_to_right_nl(
+    Node_Base* parent, Node_Base* node, Node_Base* left, int right_h) {
+    Node_Guard left_guard(left);
+    int left_h = left->height.load();
+    if(left_h - right_h <= 1) {
+        return node;
+    };
+    Node_Base* left_right = left->right.load();
+    int left_left_h = m_height(left->left.load());
+    int left_right_h = m_height(left_right);
+    if(left_left_h >= left_right_h) {
+        return m_rotate_right_nl(parent, node, left, right_h, left_left_h,
+                                 left_right, left_right_h);
+    };
+    {
+        Node_Guard left_right_guard(left_right);
+        left_right_h = left_right->height.load();
+        if(left_left_h >= left_right_h) {
+            return m_rotate_right_nl(parent, node, left, right_h,
+                                     left_left_h, left_right, left_right_h);
+        };
+        int left_right_left_h = m_height(left_right->left.load());
+        int balance = left_left_h - left_right_left_h;
+        if(balance >= -1 && balance <= 1 &&
+           !((left_left_h == 0 || left_right_left_h == 0) &&
+             !left->present.load())) {
+            return m_rotate_right_over_left_nl(parent, node, left, right_h,
+                                               left_left_h, left_right,
+                                               left_right_left_h);
+        };
+    };
+    // the double rotation would leave left unbalanced, fix left first
+    return m_rebalance_to_left_nl(node, left, left_right, left_left_h);
+};
+
+template<class T, class Compare, class Alloc>
+typename Concurrent_Tree<T, Compare, Alloc>::Node_Base*
+Concurrent_Tree<T, Compare, Alloc>::m_rebalance_to_left_nl(
+    Node_Base* parent, Node_Base* node, Node_Base* right, int left_h) {
+    Node_Guard right_guard(right);
+    int right_h = right->height.load();
+    if(left_h - right_h >= -1) {
+        return node;
+    };
+    Node_Base* right_left = right->left.load();
+    int right_left_h = m_height(right_left);
+    int right_right_h = m_height(right->right.load());
+    if(right_right_h >= right_left_h) {
+        return m_rotate_left_nl(parent, node, left_h, right, right_left,
+                                right_left_h, right_right_h);
+    };
+    {
+        Node_Guard right_left_guard(right_left);
+        right_left_h = right_left->height.load();
+        if(right_right_h >= right_left_h) {
+            return m_rotate_left_nl(parent, node, left_h, right, right_left,
+                                    right_left_h, right_right_h);
+        };
+        int right_left_right_h = m_height(right_left->right.load());
+        int balance = right_right_h - right_left_right_h;
+        if(balance >= -1 && balance <= 1 &&
+           !((right_right_h == 0 || right_left_right_h == 0) &&
+             !right->present.load())) {
+            return m_rotate_left_over_right_nl(parent, node, left_h, right,
+                                               right_left, right_right_h,
+                                               right_left_right_h);
+        };
+    };
+    return m_rebalance_to_right_nl(node, right, right_left, right_right_h);
+};
+
+// node moves down, so its version is marked shrinking meanwhile;
+// left only gains keys and needs no mark
+template<class T, class Compare, class Alloc>
+typename Concurrent_Tree<T, Compare, Alloc>::Node_Base*
+Concurrent_Tree<T, Compare, Alloc>::m_rotate_right_nl(
+    Node_Base* parent, Node_Base* node, Node_Base* left, int right_h,
+    int left_left_h, Node_Base* left_right, int left_right_h) {
+    std::uint64_t version = node->version.load();
+    Node_Base* parent_left = parent->left.load();
+    node->version.store(m_begin_shrink(version));
+
+    node->left.store(left_right);
+    if(left_right) {
+        left_right->parent.store(node);
+    };
+    left->right.store(node);
+    node->parent.store(left);
+    if(parent_left == node) {
+        parent->left.store(left);
+    } else {
+        parent->right.store(left);
+    };
+    left->parent.store(parent);
+
+    int node_h = 1 + std::max(left_right_h, right_h);
+    node->height.store(node_h);
+    left->height.store(1 + std::max(left_left_h, node_h));
+
+    node->version.store(m_end_shrink(version));
+
+    // what is left to repair, lowest first
+    int node_balance = left_right_h - right_h;
+    if(node_balance < -1 || node_balance > 1) {
+        return node;
+    };
+    if((!left_right || right_h == 0) && !node->present.load()) {
+        return node;
+    };
+    int left_balance = left_left_h - node_h;
+    if(left_balance < -1 || left_balance > 1) {
+        return left;
+    };
+    if(left_left_h == 0 && !left->present.load()) {
+        return left;
+    };
+    return m_fix_height_nl(parent);
+};
+
+template<class T, class Compare, class Alloc>
+typename Concurrent_Tree<T, Compare, Alloc>::Node_Base*
+Concurrent_Tree<T, Compare, Alloc>::m_rotate_left_nl(
+    Node_Base* parent, Node_Base* node, int left_h, Node_Base* right,
+    Node_Base* right_left, int right_left_h, int right_right_h) {
+    std::uint64_t version = node->version.load();
+    Node_Base* parent_left = parent->left.load();
+    node->version.store(m_begin_shrink(version));
+
+    node->right.store(right_left);
+    if(right_left) {
+        right_left->parent.store(node);
+    };
+    right->left.store(node);
+    node->parent.store(right);
+    if(parent_left == node) {
+        parent->left.store(right);
+    } else {
+        parent->right.store(right);
+    };
+    right->parent.store(parent);
+
+    int node_h = 1 + std::max(left_h, right_left_h);
+    node->height.store(node_h);
+    right->height.store(1 + std::max(node_h, right_right_h));
+
+    node->version.store(m_end_shrink(version));
+
+    int node_balance = right_left_h - left_h;
+    if(node_balance < -1 || node_balance > 1) {
+        return node;
+    };
+    if((!right_left || left_h == 0) && !node->present.load()) {
+        return node;
+    };
+    int right_balance = right_right_h - node_h;
+    if(right_balance < -1 || right_balance > 1) {
+        return right;
+    };
+    if(right_right_h == 0 && !right->present.load()) {
+        return right;
+    };
+    return m_fix_height_nl(parent);
+};
+
+// both node and left move down below left_right
+template<class T, class Compare, class Alloc>
+typename Concurrent_Tree<T, Compare, Alloc>::Node_Base*
+Concurrent_Tree<T, Compare, Alloc>::m_rotate_right_over_left_nl(
+    Node_Base* parent, Node_Base* node, Node_Base* left, int right_h,
+    int left_left_h, Node_Base* left_right, int left_right_left_h) {
+    std::uint64_t version = node->version.load();
+    std::uint64_t left_version = left->version.load();
+    Node_Base* parent_left = parent->left.load();
+    Node_Base* left_right_left = left_right->left.load();
+    Node_Base* left_right_right = left_right->right.load();
+    int left_right_right_h = m_height(left_right_right);
+
+    node->version.store(m_begin_shrink(version));
+    left->version.store(m_begin_shrink(left_version));
+
+    node->left.store(left_right_right);
+    if(left_right_right) {
+        left_right_right->parent.store(node);
+    };
+    left->right.store(left_right_left);
+    if(left_right_left) {
+        left_right_left->parent.store(left);
+    };
+    left_right->left.store(left);
+    left->parent.store(left_right);
+    left_right->right.store(node);
+    node->parent.store(left_right);
+    if(parent_left == node) {
+        parent->left.store(left_right);
+    } else {
+        parent->right.store(left_right);
+    };
+    left_right->parent.store(parent);
+
+    int node_h = 1 + std::max(left_right_right_h, right_h);
+    node->height.store(node_h);
+    int left_h = 1 + std::max(left_left_h, left_right_left_h);
+    left->height.store(left_h);
+    left_right->height.store(1 + std::max(left_h, node_h));
+
+    node->version.store(m_end_shrink(version));
+    left->version.store(m_end_shrink(left_version));
+
+    int node_balance = left_right_right_h - right_h;
+    if(node_balance < -1 || node_balance > 1) {
+        return node;
+    };
+    if((!left_right_right || right_h == 0) && !node->present.load()) {
+        return node;
+    };
+    int top_balance = left_h - node_h;
+    if(top_balance < -1 || top_balance > 1) {
+        return left_right;
+    };
+    return m_fix_height_nl(parent);
+};
+
+template<class T, class Compare, class Alloc>
+typename Concurrent_Tree<T, Compare, Alloc>::Node_Base*
+Concurrent_Tree<T, Compare, Alloc>::m_rotate_left_over_right_nl(
+    Node_Base* parent, Node_Base* node, int left_h, Node_Base* right,
+    Node_Base* right_left, int right_right_h, int right_left_right_h) {
+    std::uint64_t version = node->version.load();
+    std::uint64_t right_version = right->version.load();
+    Node_Base* parent_left = parent->left.load();
+    Node_Base* right_left_left = right_left->left.load();
+    Node_Base* right_left_right = right_left->right.load();
+    int right_left_left_h = m_height(right_left_left);
+
+    node->version.store(m_begin_shrink(version));
+    right->version.store(m_begin_shrink(right_version));
+
+    node->right.store(right_left_left);
+    if(right_left_left) {
+        right_left_left->parent.store(node);
+    };
+    right->left.store(right_left_right);
+    if(right_left_right) {
+        right_left_right->parent.store(right);
+    };
+    right_left->right.store(right);
+    right->parent.store(right_left);
+    right_left->left.store(node);
+    node->parent.store(right_left);
+    if(parent_left == node) {
+        parent->left.store(right_left);
+    } else {
+        parent->right.store(right_left);
+    };
+    right_left->parent.store(parent);
+
+    int node_h = 1 + std::max(left_h, right_left_left_h);
+    node->height.store(node_h);
+    int right_h = 1 + std::max(right_left_right_h, right_right_h);
+    right->height.store(right_h);
+    right_left->height.store(1 + std::max(node_h, right_h));
+
+    node->version.store(m_end_shrink(version));
+    right->version.store(m_end_shrink(right_version));
+
+    int node_balance = right_left_left_h - left_h;
+    if(node_balance < -1 || node_balance > 1) {
+        return node;
+    };
+    if((!right_left_left || left_h == 0) && !node->present.load()) {
+        return node;
+    };
+    int top_balance = right_h - node_h;
+    if(top_balance < -1 || top_balance > 1) {
+        return right_left;
+    };
+    return m_fix_height_nl(parent);
+};
+
+template<class T, class Compare, class Alloc>
+typename Concurrent_Tree<T, Compare, Alloc>::Node*
+Concurrent_Tree<T, Compare, Alloc>::m_create_node(const T& key,
+                                                  Node_Base* parent) {
+    Node* node = Node_Alloc_Traits::allocate(m_node_allocator, 1);
+    try {
+        Node_Alloc_Traits::construct(m_node_allocator, node, key, parent);
+    } catch(...) {
+        Node_Alloc_Traits::deallocate(m_node_allocator, node, 1);
+        throw;
+    };
+    return node;
+};
+
+template<class T, class Compare, class Alloc>
+void Concurrent_Tree<T, Compare, Alloc>::m_destroy_node(Node* node) {
+    Node_Alloc_Traits::destroy(m_node_allocator, node);
+    Node_Alloc_Traits::deallocate(m_node_allocator, node, 1);
+};
+
+template<class T, class Compare, class Alloc>
+void Concurrent_Tree<T, Compare, Alloc>::m_destroy_subtree(
+    Node_Base* node) {
+    if(node) {
+        m_destroy_subtree(node->left.load());
+        m_destroy_subtree(node->right.load());
+        m_destroy_node(static_cast<Node*>(node));
+    };
+};
+
+template<class T, class Compare, class Alloc>
+void Concurrent_Tree<T, Compare, Alloc>::m_retire(Node_Base* node) {
+    m_current_slot->retired.emplace_back(static_cast<Node*>(node),
+                                         m_epoch.load());
+};
+
+// Whoever can still reach a node unlinked in epoch e began in e or
+// earlier, so it is safe once every pinned slot is past e
+template<class T, class Compare, class Alloc>
+void Concurrent_Tree<T, Compare, Alloc>::m_reclaim(Epoch_Slot* slot) {
+    std::uint64_t epoch = m_epoch.load();
+    std::uint64_t oldest = epoch;
+    for(std::size_t i = 0; i < mc_slots; ++i) {
+        std::uint64_t pinned = m_slots[i].epoch.load();
+        // the own slot holds no nodes at this point
+        if(&m_slots[i] != slot && pinned && pinned < oldest) {
+            oldest = pinned;
+        };
+    };
+    if(oldest == epoch) {
+        m_epoch.compare_exchange_strong(epoch, epoch + 1);
+    };
+    auto& retired = slot->retired;
+    std::size_t kept = 0;
+    for(std::size_t i = 0; i < retired.size(); ++i) {
+        if(retired[i].second < oldest) {
+            m_destroy_node(retired[i].first);
+        } else {
+            retired[kept++] = retired[i];
+        };
+    };
+    retired.resize(kept);
+    // a stalled reader keeps nodes, don't rescan on every operation
+    slot->reclaim_at = std::max(mc_reclaim_batch, 2 * kept);
+};
+
+// linear probing from the thread's own place, yielding after a full
+// round of busy slots
+template<class T, class Compare, class Alloc>
+typename Concurrent_Tree<T, Compare, Alloc>::Epoch_Slot*
+Concurrent_Tree<T, Compare, Alloc>::m_pin() const {
+    std::size_t start = std::hash<std::thread::id>()(
+        std::this_thread::get_id());
+    for(std::size_t i = 0; ; ++i) {
+        Epoch_Slot& slot = m_slots[(start + i) % mc_slots];
+        std::uint64_t free = 0;
+        if(!slot.epoch.load(std::memory_order_relaxed) &&
+           slot.epoch.compare_exchange_strong(free, m_epoch.load())) {
+            return &slot;
+        };
+        if((i + 1) % mc_slots == 0) {
+            std::this_thread::yield();
+        };
+    };
+};
+
+
+// class Concurrent_Tree::Epoch_Guard methods
+
+template<class T, class Compare, class Alloc>
+Concurrent_Tree<T, Compare, Alloc>::Epoch_Guard::Epoch_Guard(
+    const Concurrent_Tree* tree)
+    : m_writer(nullptr), m_slot(tree->m_pin()),
+      m_previous(m_current_slot) {
+    m_current_slot = m_slot;
+};
+
+template<class T, class Compare, class Alloc>
+Concurrent_Tree<T, Compare, Alloc>::Epoch_Guard::Epoch_Guard(
+    Concurrent_Tree* tree)
+    : Epoch_Guard(static_cast<const Concurrent_Tree*>(tree)) {
+    m_writer = tree;
+};
+
+template<class T, class Compare, class Alloc>
+Concurrent_Tree<T, Compare, Alloc>::Epoch_Guard::~Epoch_Guard() {
+    m_current_slot = m_previous;
+    if(m_writer && m_slot->retired.size() >= m_slot->reclaim_at) {
+        m_writer->m_reclaim(m_slot);
+    };
+    m_slot->epoch.store(0);
+};
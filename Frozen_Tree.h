@@ -0,0 +1,347 @@
+#pragma once
+#include <memory>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+#include "Three_Way.h"
+
+
+// Immutable sorted set in one array, made by Tree::freeze() or from any
+// sorted range of unique keys.
+// The keys are stored in Eytzinger (BFS) order: the implicit tree has
+// node k at keys[k] and its children at 2k and 2k + 1. A search has
+// no data-dependent branches, k = 2k + (key[k] < probe), and prefetches
+// the cache line holding the descendants a few levels down, so the
+// misses of successive levels overlap instead of being chased one by
+// one. The array starts on a cache line, so with keys of 1, 2, 4 ... 64
+// bytes every such block of descendants fills exactly one line.
+// Iteration walks the implicit tree in order.
+//
+// Usage: Frozen_Tree<int> frozen = tree.freeze();
+template<class T, class Compare=std::less<T>>
+class Frozen_Tree : private Compare_Holder<Compare> {
+ private:
+    class iterator;
+
+    using Compare_Base = Compare_Holder<Compare>;
+
+ public:
+    using const_iterator = iterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    Frozen_Tree() {};
+    // [first, last) must be sorted by compare and free of duplicates
+    template<class ForwardIt>
+    Frozen_Tree(ForwardIt first, ForwardIt last,
+                const Compare& compare = Compare());
+
+    const_iterator find(const T& key) const { return m_find(key); };
+    bool contains(const T& key) const { return m_find(key) != end(); };
+    // first element not less than key
+    const_iterator lower_bound(const T& key) const
+        { return iterator(m_lower_bound(key), this); };
+    // first element greater than key
+    const_iterator upper_bound(const T& key) const
+        { return iterator(m_upper_bound(key), this); };
+    std::size_t count(const T& key) const { return contains(key); };
+
+    // Heterogeneous lookup with a transparent comparator (std::less<> etc.)
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    const_iterator find(const Key& key) const { return m_find(key); };
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    bool contains(const Key& key) const { return m_find(key) != end(); };
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    const_iterator lower_bound(const Key& key) const
+        { return iterator(m_lower_bound(key), this); };
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    const_iterator upper_bound(const Key& key) const
+        { return iterator(m_upper_bound(key), this); };
+
+    std::size_t size() const
+        { return m_keys.empty() ? 0 : m_keys.size() - 1; };
+
+    Compare key_comp() const { return this->comparator(); };
+
+    // Different iterator getters
+    iterator begin() const { return iterator(m_first(size()), this); };
+    const_iterator cbegin() const { return begin(); };
+    iterator end() const { return iterator(0, this); };
+    const_iterator cend() const { return end(); };
+    reverse_iterator rbegin() const
+        { return reverse_iterator(end()); };
+    const_reverse_iterator rcbegin() const
+        { return const_reverse_iterator(end()); };
+    reverse_iterator rend() const
+        { return reverse_iterator(begin()); };
+    const_reverse_iterator rcend() const
+        { return const_reverse_iterator(begin()); };
+
+    iterator before_end() const { return iterator(m_last(size()), this); };
+
+ private:
+    static constexpr std::size_t mc_cache_line = 64;
+
+    // Allocates on cache line boundaries
+    template<class U>
+    struct Line_Allocator {
+        using value_type = U;
+        static constexpr std::size_t mc_align =
+            (alignof(U) > mc_cache_line) ? alignof(U) : mc_cache_line;
+
+        Line_Allocator() {};
+        template<class V>
+        Line_Allocator(const Line_Allocator<V>&) {};
+
+        U* allocate(std::size_t n)
+            { return static_cast<U*>(::operator new(
+                  n * sizeof(U), std::align_val_t(mc_align))); };
+        void deallocate(U* ptr, std::size_t)
+            { ::operator delete(ptr, std::align_val_t(mc_align)); };
+
+        template<class V>
+        bool operator==(const Line_Allocator<V>&) const { return true; };
+        template<class V>
+        bool operator!=(const Line_Allocator<V>&) const { return false; };
+    };
+
+    // node k of the implicit tree is m_keys[k], 0 is no node; m_keys[0]
+    // is a copy of a key that only pads, so that m_keys[k * 2^d] starts
+    // a cache line for line-dividing key sizes
+    std::vector<T, Line_Allocator<T>> m_keys;
+
+    // The node 2^d k is the leftmost descendant of k d levels down, one
+    // cache line holds it and its next mc_prefetch_nodes - 1 neighbours
+    // when sizeof(T) divides the line, otherwise they may spill into the
+    // next line, which is prefetched too
+    static constexpr std::size_t mc_prefetch_nodes =
+        (sizeof(T) < mc_cache_line) ? mc_cache_line / sizeof(T) : 1;
+    static constexpr bool mc_line_blocks = mc_cache_line % sizeof(T) == 0;
+
+    // Plain node number, 0 is both the past-the-end and the before-begin
+    // position: ++ from it gives begin(), -- gives before_end().
+    class iterator {
+     private:
+        std::size_t self;
+        const Frozen_Tree* owner;
+
+     public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        iterator() : self(0), owner(nullptr) {};
+        iterator(std::size_t init,
+                 const Frozen_Tree* owner) : self(init), owner(owner) {};
+
+        // for LegacyIterator
+        const T& operator*() const { return owner->m_keys[self]; };
+        iterator& operator++()
+            { std::size_t size = owner->size();
+              self = self ? m_next(self, size) : m_first(size);
+              return *this; };
+
+        // for LegacyInputIterator
+        bool operator==(const iterator& to_compare) const
+            { return self == to_compare.self; };
+        bool operator!=(const iterator& to_compare) const
+            { return self != to_compare.self; };
+        const T* operator->() const { return &owner->m_keys[self]; };
+        iterator operator++(int)
+            { iterator temp = *this; ++(*this); return temp; };
+
+        // for BidirectionalIterator
+        iterator& operator--()
+            { std::size_t size = owner->size();
+              self = self ? m_prev(self, size) : m_last(size);
+              return *this; };
+        iterator operator--(int)
+            { iterator temp = *this; --(*this); return temp; };
+    };
+
+    template<class Key>
+    const_iterator m_find(const Key& key) const;
+    // node numbers of the bounds, 0 if there is none
+    template<class Key>
+    std::size_t m_lower_bound(const Key& key) const;
+    template<class Key>
+    std::size_t m_upper_bound(const Key& key) const;
+
+    // hints the cache about the descendants of node k, if any
+    void m_prefetch(std::size_t k) const;
+    // The descent ends below a leaf at k = 2^d j + (right turns made
+    // after the last left turn, as ones); the answer is j, the node of
+    // the last left turn
+    static std::size_t m_last_left_turn(std::size_t k);
+
+    // in-order neighbours in the implicit tree of size nodes,
+    // 0 past either end
+    static std::size_t m_first(std::size_t size);
+    static std::size_t m_last(std::size_t size);
+    static std::size_t m_next(std::size_t k, std::size_t size);
+    static std::size_t m_prev(std::size_t k, std::size_t size);
+};
+
+
+// class Frozen_Tree methods
+
+// The sorted keys are dealt out to the nodes by an in-order walk of the
+// implicit tree
+template<class T, class Compare>
+template<class ForwardIt>
+Frozen_Tree<T, Compare>::Frozen_Tree(ForwardIt first, ForwardIt last,
+                                     const Compare& compare)
+    : Compare_Base(compare) {
+    std::vector<ForwardIt> sorted;
+    for(; first != last; ++first) {
+        sorted.push_back(first);
+    };
+    std::size_t size = sorted.size();
+    // rank[k] is the position of node k in sorted order
+    std::vector<std::size_t> rank(size + 1);
+    std::size_t next_rank = 0;
+    for(std::size_t k = m_first(size); k; k = m_next(k, size)) {
+        rank[k] = next_rank++;
+    };
+    if(!size) {
+        return;
+    };
+    m_keys.reserve(size + 1);
+    m_keys.push_back(*sorted.front());
+    for(std::size_t k = 1; k <= size; ++k) {
+        m_keys.push_back(*sorted[rank[k]]);
+    };
+};
+
+template<class T, class Compare>
+template<class Key>
+typename Frozen_Tree<T, Compare>::const_iterator
+Frozen_Tree<T, Compare>::m_find(const Key& key) const {
+    std::size_t k = m_lower_bound(key);
+    if(k && !this->comparator()(key, m_keys[k])) {
+        return const_iterator(k, this);
+    };
+    return end();
+};
+
+template<class T, class Compare>
+template<class Key>
+std::size_t Frozen_Tree<T, Compare>::m_lower_bound(const Key& key) const {
+    const Compare& compare = this->comparator();
+    const T* keys = m_keys.data();
+    std::size_t size = this->size();
+    std::size_t k = 1;
+    while(k <= size) {
+        m_prefetch(k);
+        k = 2 * k + static_cast<std::size_t>(compare(keys[k], key));
+    };
+    return m_last_left_turn(k);
+};
+
+template<class T, class Compare>
+template<class Key>
+std::size_t Frozen_Tree<T, Compare>::m_upper_bound(const Key& key) const {
+    const Compare& compare = this->comparator();
+    const T* keys = m_keys.data();
+    std::size_t size = this->size();
+    std::size_t k = 1;
+    while(k <= size) {
+        m_prefetch(k);
+        k = 2 * k + static_cast<std::size_t>(!compare(key, keys[k]));
+    };
+    return m_last_left_turn(k);
+};
+
+// The address is formed as an integer: it may lie past the array,
+// which a prefetch tolerates but pointer arithmetic does not
+template<class T, class Compare>
+void Frozen_Tree<T, Compare>::m_prefetch(std::size_t k) const {
+#if defined(__GNUC__)
+    std::uintptr_t address =
+        reinterpret_cast<std::uintptr_t>(m_keys.data()) +
+        k * mc_prefetch_nodes * sizeof(T);
+    __builtin_prefetch(reinterpret_cast<const void*>(address));
+    if constexpr(!mc_line_blocks) {
+        __builtin_prefetch(reinterpret_cast<const void*>(
+            address + mc_prefetch_nodes * sizeof(T) - 1));
+    };
+#else
+    (void)k;
+#endif
+};
+
+template<class T, class Compare>
+std::size_t Frozen_Tree<T, Compare>::m_last_left_turn(std::size_t k) {
+#if defined(__GNUC__)
+    return k >> (__builtin_ctzll(~static_cast<unsigned long long>(k)) + 1);
+#else
+    while(k & 1) {
+        k >>= 1;
+    };
+    return k >> 1;
+#endif
+};
+
+template<class T, class Compare>
+std::size_t Frozen_Tree<T, Compare>::m_first(std::size_t size) {
+    std::size_t k = 0;
+    if(size) {
+        k = 1;
+        while(2 * k <= size) {
+            k *= 2;
+        };
+    };
+    return k;
+};
+
+template<class T, class Compare>
+std::size_t Frozen_Tree<T, Compare>::m_last(std::size_t size) {
+    std::size_t k = 0;
+    if(size) {
+        k = 1;
+        while(2 * k + 1 <= size) {
+            k = 2 * k + 1;
+        };
+    };
+    return k;
+};
+
+// the leftmost node of the right subtree, or up to the first ancestor
+// reached from its left
+template<class T, class Compare>
+std::size_t Frozen_Tree<T, Compare>::m_next(std::size_t k,
+                                            std::size_t size) {
+    if(2 * k + 1 <= size) {
+        k = 2 * k + 1;
+        while(2 * k <= size) {
+            k *= 2;
+        };
+        return k;
+    };
+    return m_last_left_turn(k);
+};
+
+// the rightmost node of the left subtree, or up to the first ancestor
+// reached from its right
+template<class T, class Compare>
+std::size_t Frozen_Tree<T, Compare>::m_prev(std::size_t k,
+                                            std::size_t size) {
+    if(2 * k <= size) {
+        k = 2 * k;
+        while(2 * k + 1 <= size) {
+            k = 2 * k + 1;
+        };
+        return k;
+    };
+    while(!(k & 1)) {
+        k >>= 1;
+    };
+    return k >> 1;
+};
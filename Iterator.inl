@@ -0,0 +1,96 @@
+#pragma once
+#include "RBTree.h"
+/*--------------------------Constructors-------------------------------*/
+template <class T, class Compare>
+RBTree<T, Compare>::iterator::iterator() : chain_(nullptr), tree_(nullptr)
+{
+}
+
+template <class T, class Compare>
+RBTree<T, Compare>::iterator::iterator(Chain* chain, const RBTree* tree) : chain_(chain), tree_(tree)
+{
+}
+/*------------------------------------------------------------------------*/
+
+/*------------------------Access and comparison---------------------------*/
+template <class T, class Compare>
+const T& RBTree<T, Compare>::iterator::operator*() const
+{
+	return chain_->value;
+}
+
+template <class T, class Compare>
+const T* RBTree<T, Compare>::iterator::operator->() const
+{
+	return &(chain_->value);
+}
+
+template <class T, class Compare>
+bool RBTree<T, Compare>::iterator::operator==(const iterator& other) const
+{
+	return chain_ == other.chain_;
+}
+
+template <class T, class Compare>
+bool RBTree<T, Compare>::iterator::operator!=(const iterator& other) const
+{
+	return chain_ != other.chain_;
+}
+/*------------------------------------------------------------------------*/
+
+/*------------------------Moving------------------------------------------*/
+template <class T, class Compare>
+typename RBTree<T, Compare>::iterator& RBTree<T, Compare>::iterator::operator++()
+{
+	if (chain_ == nullptr) {
+		*this = tree_->begin();
+		return *this;
+	}
+	if (chain_->right != tree_->nil_) {
+		chain_ = tree_->min_value(chain_->right);
+		return *this;
+	}
+	/*Climbing out of the root gives nullptr, which is end()*/
+	while (chain_->parent != nullptr && chain_->parent->right == chain_) {
+		chain_ = chain_->parent;
+	}
+	chain_ = chain_->parent;
+	return *this;
+}
+
+template <class T, class Compare>
+typename RBTree<T, Compare>::iterator RBTree<T, Compare>::iterator::operator++(int)
+{
+	iterator temp = *this;
+	++(*this);
+	return temp;
+}
+
+template <class T, class Compare>
+typename RBTree<T, Compare>::iterator& RBTree<T, Compare>::iterator::operator--()
+{
+	if (chain_ == nullptr) {
+		if (tree_->root_ != tree_->nil_) {
+			chain_ = tree_->max_value(tree_->root_);
+		}
+		return *this;
+	}
+	if (chain_->left != tree_->nil_) {
+		chain_ = tree_->max_value(chain_->left);
+		return *this;
+	}
+	while (chain_->parent != nullptr && chain_->parent->left == chain_) {
+		chain_ = chain_->parent;
+	}
+	chain_ = chain_->parent;
+	return *this;
+}
+
+template <class T, class Compare>
+typename RBTree<T, Compare>::iterator RBTree<T, Compare>::iterator::operator--(int)
+{
+	iterator temp = *this;
+	--(*this);
+	return temp;
+}
+/*------------------------------------------------------------------------*/
@@ -0,0 +1,177 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define KEY_SEARCH_X86 1
+#endif
+
+
+// Branch-free search in a short sorted array of arithmetic keys, used by
+// the wide nodes of BTree. A binary search branches on every probe and
+// mispredicts about half of them for random lookups. Here the probe is
+// compared with every key and the hits are counted: the number of keys
+// less than the probe is its lower bound index, the number of keys not
+// greater is its upper bound index.
+// 32 and 64-bit integers are compared 8 (4) at a time with AVX2 or
+// SSE4.2, movemask and popcount, chosen at run time by the CPU. Other
+// types, CPUs and compilers use the scalar loop, which the compiler may
+// vectorize for the build target anyway.
+//
+// Usage: std::size_t index = count_less(keys, count, key);
+
+enum class Simd_Level { scalar, sse42, avx2 };
+
+// Detected on the first call. The kernels get their instruction set from
+// target attributes, so the rest of the program needs no -mavx2.
+inline Simd_Level simd_level() {
+#ifdef KEY_SEARCH_X86
+    static const Simd_Level level =
+        __builtin_cpu_supports("avx2") ? Simd_Level::avx2 :
+        __builtin_cpu_supports("sse4.2") ? Simd_Level::sse42 :
+        Simd_Level::scalar;
+    return level;
+#else
+    return Simd_Level::scalar;
+#endif
+};
+
+// number of keys less than key (Greater = false) or greater than key
+// (Greater = true) among keys[first, count)
+template<bool Greater, class T>
+std::size_t scalar_count(const T* keys, std::size_t first,
+                         std::size_t count, T key) {
+    std::size_t hits = 0;
+    for(std::size_t i = first; i < count; ++i) {
+        hits += Greater ? (key < keys[i]) : (keys[i] < key);
+    };
+    return hits;
+};
+
+#ifdef KEY_SEARCH_X86
+// Signed compares only: for unsigned keys both sides get their sign bit
+// flipped, which keeps the order. Lanes past the last full vector are
+// counted by scalar_count.
+
+template<bool Greater, class T>
+__attribute__((target("avx2,popcnt")))
+std::size_t avx2_count_32(const T* keys, std::size_t count, T key) {
+    const __m256i flip = _mm256_set1_epi32(
+        std::is_signed<T>::value ? 0 : static_cast<int>(0x80000000u));
+    const __m256i probe = _mm256_xor_si256(
+        _mm256_set1_epi32(static_cast<int>(key)), flip);
+    std::size_t hits = 0;
+    std::size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256i chunk = _mm256_xor_si256(_mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(keys + i)), flip);
+        __m256i hit = Greater ? _mm256_cmpgt_epi32(chunk, probe)
+                              : _mm256_cmpgt_epi32(probe, chunk);
+        hits += __builtin_popcount(
+            _mm256_movemask_ps(_mm256_castsi256_ps(hit)));
+    };
+    return hits + scalar_count<Greater>(keys, i, count, key);
+};
+
+template<bool Greater, class T>
+__attribute__((target("avx2,popcnt")))
+std::size_t avx2_count_64(const T* keys, std::size_t count, T key) {
+    const __m256i flip = _mm256_set1_epi64x(
+        std::is_signed<T>::value ? 0 : static_cast<long long>(
+            0x8000000000000000ull));
+    const __m256i probe = _mm256_xor_si256(
+        _mm256_set1_epi64x(static_cast<long long>(key)), flip);
+    std::size_t hits = 0;
+    std::size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m256i chunk = _mm256_xor_si256(_mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(keys + i)), flip);
+        __m256i hit = Greater ? _mm256_cmpgt_epi64(chunk, probe)
+                              : _mm256_cmpgt_epi64(probe, chunk);
+        hits += __builtin_popcount(
+            _mm256_movemask_pd(_mm256_castsi256_pd(hit)));
+    };
+    return hits + scalar_count<Greater>(keys, i, count, key);
+};
+
+template<bool Greater, class T>
+__attribute__((target("sse4.2,popcnt")))
+std::size_t sse42_count_32(const T* keys, std::size_t count, T key) {
+    const __m128i flip = _mm_set1_epi32(
+        std::is_signed<T>::value ? 0 : static_cast<int>(0x80000000u));
+    const __m128i probe = _mm_xor_si128(
+        _mm_set1_epi32(static_cast<int>(key)), flip);
+    std::size_t hits = 0;
+    std::size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128i chunk = _mm_xor_si128(_mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(keys + i)), flip);
+        __m128i hit = Greater ? _mm_cmpgt_epi32(chunk, probe)
+                              : _mm_cmpgt_epi32(probe, chunk);
+        hits += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(hit)));
+    };
+    return hits + scalar_count<Greater>(keys, i, count, key);
+};
+
+template<bool Greater, class T>
+__attribute__((target("sse4.2,popcnt")))
+std::size_t sse42_count_64(const T* keys, std::size_t count, T key) {
+    const __m128i flip = _mm_set1_epi64x(
+        std::is_signed<T>::value ? 0 : static_cast<long long>(
+            0x8000000000000000ull));
+    const __m128i probe = _mm_xor_si128(
+        _mm_set1_epi64x(static_cast<long long>(key)), flip);
+    std::size_t hits = 0;
+    std::size_t i = 0;
+    for(; i + 2 <= count; i += 2) {
+        __m128i chunk = _mm_xor_si128(_mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(keys + i)), flip);
+        __m128i hit = Greater ? _mm_cmpgt_epi64(chunk, probe)
+                              : _mm_cmpgt_epi64(probe, chunk);
+        hits += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(hit)));
+    };
+    return hits + scalar_count<Greater>(keys, i, count, key);
+};
+#endif
+
+// the kernel is picked by the key type at compile time and by the CPU
+// at run time
+template<bool Greater, class T>
+std::size_t count_keys(const T* keys, std::size_t count, T key) {
+    static_assert(std::is_arithmetic<T>::value, "arithmetic keys only");
+#ifdef KEY_SEARCH_X86
+    if constexpr(std::is_integral<T>::value && sizeof(T) == 4) {
+        switch(simd_level()) {
+            case Simd_Level::avx2:
+                return avx2_count_32<Greater>(keys, count, key);
+            case Simd_Level::sse42:
+                return sse42_count_32<Greater>(keys, count, key);
+            default:
+                break;
+        };
+    } else if constexpr(std::is_integral<T>::value && sizeof(T) == 8) {
+        switch(simd_level()) {
+            case Simd_Level::avx2:
+                return avx2_count_64<Greater>(keys, count, key);
+            case Simd_Level::sse42:
+                return sse42_count_64<Greater>(keys, count, key);
+            default:
+                break;
+        };
+    };
+#endif
+    return scalar_count<Greater>(keys, 0, count, key);
+};
+
+// index of the first key not less than key in sorted keys[0, count)
+template<class T>
+std::size_t count_less(const T* keys, std::size_t count, T key) {
+    return count_keys<false>(keys, count, key);
+};
+
+// index of the first key greater than key in sorted keys[0, count)
+template<class T>
+std::size_t count_not_greater(const T* keys, std::size_t count, T key) {
+    return count - count_keys<true>(keys, count, key);
+};
@@ -0,0 +1,597 @@
+#pragma once
+#include <memory>
+#include <atomic>
+#include <iterator>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <cstddef>
+
+#include "Three_Way.h"
+
+// std::atomic<std::shared_ptr> where it is race-free: libstdc++'s (12 at
+// least) unlocks relaxed after a load, a data race with the next store
+// under ThreadSanitizer. Its atomic_load/atomic_store take a mutex instead.
+#if defined(__cpp_lib_atomic_shared_ptr) && !defined(__GLIBCXX__)
+#define PERSISTENT_TREE_ATOMIC_ROOT 1
+#endif
+
+
+// Persistent AVL set: nodes are never changed once built and are shared,
+// by std::shared_ptr, between all the versions that contain them.
+// - insert and erase copy only the O(log n) nodes on the path from the
+//   root (and the few a rotation touches) and point the copies at the
+//   untouched subtrees, the old nodes stay as they were.
+// - A copy, or snapshot(), takes the root only: O(1) in time and space.
+//   Each version frees the nodes no other version shares when it dies.
+// - A snapshot can be taken from another thread while the owner keeps
+//   changing the tree (the root is exchanged atomically) and read there
+//   with no locks at all, it never waits for nor delays the writer.
+//   Only copying and snapshot() may run in other threads; every other
+//   member, const or not, belongs to the thread owning the object.
+// Nodes have no parent pointers, so iterators keep their path from the
+// root in a fixed array; they stay valid while any version holding their
+// nodes lives.
+// The allocator must be thread-safe if versions die in other threads
+// (std::allocator is, Pool_Allocator is not).
+//
+// Usage: Persistent_Tree<int> live = tree.persist();
+//        Persistent_Tree<int> report = live.snapshot();   // O(1)
+template<class T,
+         class Compare=std::less<T>,
+         class Alloc=std::allocator<T>
+        >
+class Persistent_Tree : private Compare_Holder<Compare> {
+ private:
+    struct Node;
+    class iterator;
+
+    using Node_Ptr = std::shared_ptr<const Node>;
+    using Compare_Base = Compare_Holder<Compare>;
+
+ public:
+    using const_iterator = iterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    Persistent_Tree() {};
+    explicit Persistent_Tree(const Compare& compare,
+                             const Alloc& alloc = Alloc())
+        : Compare_Base(compare), m_allocator(alloc) {};
+    // Like Tree::assign: O(n) for sorted input, unsorted input is sorted
+    // and deduplicated first
+    template<class InputIt>
+    Persistent_Tree(InputIt first, InputIt last,
+                    const Compare& compare = Compare(),
+                    const Alloc& alloc = Alloc());
+    // O(1), shares all nodes with copy; safe to call from any thread
+    Persistent_Tree(const Persistent_Tree& copy)
+        : Compare_Base(copy), m_allocator(copy.m_allocator)
+        { m_store_root(copy.m_load_root()); };
+    // owner only, other is left empty
+    Persistent_Tree(Persistent_Tree&& other) noexcept
+        : Compare_Base(other), m_allocator(other.m_allocator)
+        { m_store_root(other.m_load_root()); other.m_store_root(nullptr); };
+
+    // copy may be read from any thread, *this is the owner's
+    Persistent_Tree& operator=(const Persistent_Tree& copy);
+    // owner of both only
+    Persistent_Tree& operator=(Persistent_Tree&& other) noexcept;
+
+    // The current version, O(1); safe to call from any thread
+    Persistent_Tree snapshot() const { return *this; };
+
+    // true if the key was missing and is inserted now
+    bool insert(const T& key) { return m_insert_key(key); };
+    bool insert(T&& key) { return m_insert_key(std::move(key)); };
+    std::size_t erase(const T& key);
+    void clear() { m_store_root(nullptr); };
+
+    const_iterator find(const T& key) const { return m_find(key); };
+    bool contains(const T& key) const { return m_find(key) != end(); };
+    // first element not less than key
+    const_iterator lower_bound(const T& key) const
+        { return m_lower_bound(key); };
+    // first element greater than key
+    const_iterator upper_bound(const T& key) const
+        { return m_upper_bound(key); };
+    std::size_t count(const T& key) const { return contains(key); };
+
+    // Heterogeneous lookup with a transparent comparator (std::less<> etc.)
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    const_iterator find(const Key& key) const { return m_find(key); };
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    bool contains(const Key& key) const { return m_find(key) != end(); };
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    const_iterator lower_bound(const Key& key) const
+        { return m_lower_bound(key); };
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    const_iterator upper_bound(const Key& key) const
+        { return m_upper_bound(key); };
+
+    std::size_t size() const { return m_size(m_root_node()); };
+
+    Compare key_comp() const { return this->comparator(); };
+
+    // Different iterator getters
+    iterator begin() const;
+    const_iterator cbegin() const { return begin(); };
+    iterator end() const { return iterator(m_root_node()); };
+    const_iterator cend() const { return end(); };
+    reverse_iterator rbegin() const
+        { return reverse_iterator(end()); };
+    const_reverse_iterator rcbegin() const
+        { return const_reverse_iterator(end()); };
+    reverse_iterator rend() const
+        { return reverse_iterator(begin()); };
+    const_reverse_iterator rcend() const
+        { return const_reverse_iterator(begin()); };
+
+ private:
+    struct Node {
+        T value;
+        Node_Ptr left;
+        Node_Ptr right;
+        int height;
+        std::size_t size;
+
+        template<class Value>
+        Node(Value&& value, Node_Ptr left, Node_Ptr right)
+            : value(std::forward<Value>(value)),
+              left(std::move(left)), right(std::move(right)),
+              height(1 + std::max(m_height(this->left.get()),
+                                  m_height(this->right.get()))),
+              size(1 + m_size(this->left.get()) +
+                   m_size(this->right.get())) {};
+    };
+
+    // The nodes from the root to the element, none for end(). The root
+    // is kept to step back from end().
+    // An AVL tree of n nodes is lower than 1.45 * log2(n + 2), so the
+    // path never outgrows mc_max_height for any std::size_t n.
+    class iterator {
+     private:
+        friend class Persistent_Tree;
+
+        static constexpr int mc_max_height = 96;
+
+        const Node* path[mc_max_height];
+        int depth;
+        const Node* root;
+
+        // end() of the tree with this root, the path is pushed after
+        explicit iterator(const Node* root) : depth(0), root(root) {};
+
+        void push(const Node* node) { path[depth++] = node; };
+        const Node* top() const { return path[depth - 1]; };
+
+     public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        iterator() : depth(0), root(nullptr) {};
+        // only the used part of the path is copied
+        iterator(const iterator& other)
+            : depth(other.depth), root(other.root)
+            { std::copy(other.path, other.path + depth, path); };
+        iterator& operator=(const iterator& other);
+
+        // for LegacyIterator
+        const T& operator*() const { return top()->value; };
+        iterator& operator++();
+
+        // for LegacyInputIterator
+        bool operator==(const iterator& to_compare) const
+            { return depth == 0 ? to_compare.depth == 0
+                                : to_compare.depth != 0 &&
+                                  top() == to_compare.top(); };
+        bool operator!=(const iterator& to_compare) const
+            { return !(*this == to_compare); };
+        const T* operator->() const { return &top()->value; };
+        iterator operator++(int)
+            { iterator temp = *this; ++(*this); return temp; };
+
+        // for BidirectionalIterator
+        iterator& operator--();
+        iterator operator--(int)
+            { iterator temp = *this; --(*this); return temp; };
+    };
+
+    Alloc m_allocator;
+    // Read and written only through m_load_root() and m_store_root()
+#ifdef PERSISTENT_TREE_ATOMIC_ROOT
+    std::atomic<Node_Ptr> m_root;
+#else
+    Node_Ptr m_root;
+#endif
+    // m_root.get() for the owner, kept by m_store_root()
+    const Node* m_owner_root = nullptr;
+
+    // The current version, from any thread; copies and snapshot() use it
+    Node_Ptr m_load_root() const;
+    // Publishes a new version, owner only
+    void m_store_root(Node_Ptr root);
+    // The current root for the owner's own reads: a plain pointer, no
+    // atomic and no reference count
+    const Node* m_root_node() const { return m_owner_root; };
+
+    static int m_height(const Node* node) { return node ? node->height : 0; };
+    static std::size_t m_size(const Node* node)
+        { return node ? node->size : 0; };
+    template<class A, class B>
+    int m_three_way(const A& a, const B& b) const
+        { return three_way_compare(this->comparator(), a, b); };
+
+    template<class Value>
+    Node_Ptr m_make(Value&& value, Node_Ptr left, Node_Ptr right) const;
+    // m_make with one AVL rotation if the heights differ by two
+    template<class Value>
+    Node_Ptr m_balance(Value&& value, Node_Ptr left, Node_Ptr right) const;
+    // balanced tree of keys[first, last), moved from
+    Node_Ptr m_build(std::vector<T>& keys, std::size_t first,
+                     std::size_t last) const;
+
+    template<class Value>
+    bool m_insert_key(Value&& key);
+    // The new version of the subtree, or node itself if nothing changed
+    template<class Value>
+    Node_Ptr m_insert(const Node_Ptr& node, Value& key,
+                      bool& inserted) const;
+    Node_Ptr m_erase(const Node_Ptr& node, const T& key,
+                     bool& erased) const;
+    // subtree without its least element, which is left in min
+    Node_Ptr m_erase_min(const Node_Ptr& node, const T*& min) const;
+
+    template<class Key>
+    const_iterator m_find(const Key& key) const;
+    template<class Key>
+    const_iterator m_lower_bound(const Key& key) const;
+    template<class Key>
+    const_iterator m_upper_bound(const Key& key) const;
+};
+
+
+// class Persistent_Tree methods
+
+template<class T, class Compare, class Alloc>
+template<class InputIt>
+Persistent_Tree<T, Compare, Alloc>::Persistent_Tree(InputIt first,
+                                                    InputIt last,
+                                                    const Compare& compare,
+                                                    const Alloc& alloc)
+    : Compare_Base(compare), m_allocator(alloc) {
+    std::vector<T> keys(first, last);
+    auto less = [this](const T& a, const T& b) {
+        return this->comparator()(a, b);
+    };
+    auto not_less = [&less](const T& a, const T& b) { return !less(a, b); };
+    if(std::adjacent_find(keys.begin(), keys.end(), not_less) !=
+       keys.end()) {
+        // the first of equal keys wins, as with insert
+        std::stable_sort(keys.begin(), keys.end(), less);
+        keys.erase(std::unique(keys.begin(), keys.end(), not_less),
+                   keys.end());
+    };
+    m_store_root(m_build(keys, 0, keys.size()));
+};
+
+template<class T, class Compare, class Alloc>
+Persistent_Tree<T, Compare, Alloc>&
+Persistent_Tree<T, Compare, Alloc>::operator=(const Persistent_Tree& copy) {
+    if(this != &copy) {
+        Compare_Base::operator=(copy);
+        m_allocator = copy.m_allocator;
+        m_store_root(copy.m_load_root());
+    };
+    return *this;
+};
+
+template<class T, class Compare, class Alloc>
+Persistent_Tree<T, Compare, Alloc>&
+Persistent_Tree<T, Compare, Alloc>::operator=(
+    Persistent_Tree&& other) noexcept {
+    if(this != &other) {
+        Compare_Base::operator=(other);
+        m_allocator = other.m_allocator;
+        m_store_root(other.m_load_root());
+        other.m_store_root(nullptr);
+    };
+    return *this;
+};
+
+template<class T, class Compare, class Alloc>
+std::size_t Persistent_Tree<T, Compare, Alloc>::erase(const T& key) {
+    bool erased = false;
+    Node_Ptr root = m_erase(m_load_root(), key, erased);
+    if(erased) {
+        m_store_root(std::move(root));
+    };
+    return erased;
+};
+
+template<class T, class Compare, class Alloc>
+template<class Value>
+bool Persistent_Tree<T, Compare, Alloc>::m_insert_key(Value&& key) {
+    bool inserted = false;
+    Node_Ptr root = m_insert(m_load_root(), key, inserted);
+    if(inserted) {
+        m_store_root(std::move(root));
+    };
+    return inserted;
+};
+
+// std::atomic<std::shared_ptr> if PERSISTENT_TREE_ATOMIC_ROOT, the free
+// functions on a plain shared_ptr (deprecated in C++20) otherwise
+template<class T, class Compare, class Alloc>
+typename Persistent_Tree<T, Compare, Alloc>::Node_Ptr
+Persistent_Tree<T, Compare, Alloc>::m_load_root() const {
+#ifdef PERSISTENT_TREE_ATOMIC_ROOT
+    return m_root.load(std::memory_order_acquire);
+#else
+    return std::atomic_load_explicit(&m_root, std::memory_order_acquire);
+#endif
+};
+
+template<class T, class Compare, class Alloc>
+void Persistent_Tree<T, Compare, Alloc>::m_store_root(Node_Ptr root) {
+    m_owner_root = root.get();
+#ifdef PERSISTENT_TREE_ATOMIC_ROOT
+    m_root.store(std::move(root), std::memory_order_release);
+#else
+    std::atomic_store_explicit(&m_root, std::move(root),
+                               std::memory_order_release);
+#endif
+};
+
+template<class T, class Compare, class Alloc>
+template<class Value>
+typename Persistent_Tree<T, Compare, Alloc>::Node_Ptr
+Persistent_Tree<T, Compare, Alloc>::m_make(Value&& value, Node_Ptr left,
+                                           Node_Ptr right) const {
+    return std::allocate_shared<Node>(m_allocator,
+                                      std::forward<Value>(value),
+                                      std::move(left), std::move(right));
+};
+
+// After one insert or erase below, the heights differ by two at most
+template<class T, class Compare, class Alloc>
+template<class Value>
+typename Persistent_Tree<T, Compare, Alloc>::Node_Ptr
+Persistent_Tree<T, Compare, Alloc>::m_balance(Value&& value, Node_Ptr left,
+                                              Node_Ptr right) const {
+    int left_h = m_height(left.get());
+    int right_h = m_height(right.get());
+    if(left_h > right_h + 1) {
+        if(m_height(left->left.get()) >= m_height(left->right.get())) {
+            return m_make(left->value, left->left,
+                          m_make(std::forward<Value>(value), left->right,
+                                 std::move(right)));
+        };
+        const Node* left_right = left->right.get();
+        return m_make(left_right->value,
+                      m_make(left->value, left->left, left_right->left),
+                      m_make(std::forward<Value>(value), left_right->right,
+                             std::move(right)));
+    };
+    if(right_h > left_h + 1) {
+        if(m_height(right->right.get()) >= m_height(right->left.get())) {
+            return m_make(right->value,
+                          m_make(std::forward<Value>(value),
+                                 std::move(left), right->left),
+                          right->right);
+        };
+        const Node* right_left = right->left.get();
+        return m_make(right_left->value,
+                      m_make(std::forward<Value>(value), std::move(left),
+                             right_left->left),
+                      m_make(right->value, right_left->right, right->right));
+    };
+    return m_make(std::forward<Value>(value), std::move(left),
+                  std::move(right));
+};
+
+template<class T, class Compare, class Alloc>
+typename Persistent_Tree<T, Compare, Alloc>::Node_Ptr
+Persistent_Tree<T, Compare, Alloc>::m_build(std::vector<T>& keys,
+                                            std::size_t first,
+                                            std::size_t last) const {
+    if(first == last) {
+        return nullptr;
+    };
+    std::size_t middle = first + (last - first) / 2;
+    return m_make(std::move(keys[middle]), m_build(keys, first, middle),
+                  m_build(keys, middle + 1, last));
+};
+
+// A duplicate copies nothing: every level gets its own child back
+template<class T, class Compare, class Alloc>
+template<class Value>
+typename Persistent_Tree<T, Compare, Alloc>::Node_Ptr
+Persistent_Tree<T, Compare, Alloc>::m_insert(const Node_Ptr& node,
+                                             Value& key,
+                                             bool& inserted) const {
+    if(!node) {
+        inserted = true;
+        return m_make(std::forward<Value>(key), nullptr, nullptr);
+    };
+    int order = m_three_way(key, node->value);
+    if(order < 0) {
+        Node_Ptr left = m_insert(node->left, key, inserted);
+        return inserted ? m_balance(node->value, std::move(left),
+                                    node->right)
+                        : node;
+    } else if(order > 0) {
+        Node_Ptr right = m_insert(node->right, key, inserted);
+        return inserted ? m_balance(node->value, node->left,
+                                    std::move(right))
+                        : node;
+    };
+    return node;
+};
+
+template<class T, class Compare, class Alloc>
+typename Persistent_Tree<T, Compare, Alloc>::Node_Ptr
+Persistent_Tree<T, Compare, Alloc>::m_erase(const Node_Ptr& node,
+                                            const T& key,
+                                            bool& erased) const {
+    if(!node) {
+        return node;
+    };
+    int order = m_three_way(key, node->value);
+    if(order < 0) {
+        Node_Ptr left = m_erase(node->left, key, erased);
+        return erased ? m_balance(node->value, std::move(left), node->right)
+                      : node;
+    } else if(order > 0) {
+        Node_Ptr right = m_erase(node->right, key, erased);
+        return erased ? m_balance(node->value, node->left, std::move(right))
+                      : node;
+    };
+    erased = true;
+    if(!node->left) {
+        return node->right;
+    };
+    if(!node->right) {
+        return node->left;
+    };
+    // the successor takes the place; the old node keeps it alive
+    const T* min = nullptr;
+    Node_Ptr right = m_erase_min(node->right, min);
+    return m_balance(*min, node->left, std::move(right));
+};
+
+template<class T, class Compare, class Alloc>
+typename Persistent_Tree<T, Compare, Alloc>::Node_Ptr
+Persistent_Tree<T, Compare, Alloc>::m_erase_min(const Node_Ptr& node,
+                                                const T*& min) const {
+    if(!node->left) {
+        min = &node->value;
+        return node->right;
+    };
+    return m_balance(node->value, m_erase_min(node->left, min), node->right);
+};
+
+template<class T, class Compare, class Alloc>
+template<class Key>
+typename Persistent_Tree<T, Compare, Alloc>::const_iterator
+Persistent_Tree<T, Compare, Alloc>::m_find(const Key& key) const {
+    const_iterator found(m_root_node());
+    const Node* node = found.root;
+    while(node) {
+        found.push(node);
+        int order = m_three_way(key, node->value);
+        if(order == 0) {
+            return found;
+        };
+        node = (order < 0) ? node->left.get() : node->right.get();
+    };
+    return end();
+};
+
+// the path is cut after the last node where the descent turned left
+template<class T, class Compare, class Alloc>
+template<class Key>
+typename Persistent_Tree<T, Compare, Alloc>::const_iterator
+Persistent_Tree<T, Compare, Alloc>::m_lower_bound(const Key& key) const {
+    const Compare& compare = this->comparator();
+    const_iterator bound(m_root_node());
+    int bound_depth = 0;
+    const Node* node = bound.root;
+    while(node) {
+        bound.push(node);
+        if(compare(node->value, key)) {
+            node = node->right.get();
+        } else {
+            bound_depth = bound.depth;
+            node = node->left.get();
+        };
+    };
+    bound.depth = bound_depth;
+    return bound;
+};
+
+template<class T, class Compare, class Alloc>
+template<class Key>
+typename Persistent_Tree<T, Compare, Alloc>::const_iterator
+Persistent_Tree<T, Compare, Alloc>::m_upper_bound(const Key& key) const {
+    const Compare& compare = this->comparator();
+    const_iterator bound(m_root_node());
+    int bound_depth = 0;
+    const Node* node = bound.root;
+    while(node) {
+        bound.push(node);
+        if(!compare(key, node->value)) {
+            node = node->right.get();
+        } else {
+            bound_depth = bound.depth;
+            node = node->left.get();
+        };
+    };
+    bound.depth = bound_depth;
+    return bound;
+};
+
+template<class T, class Compare, class Alloc>
+typename Persistent_Tree<T, Compare, Alloc>::iterator
+Persistent_Tree<T, Compare, Alloc>::begin() const {
+    iterator first(m_root_node());
+    for(const Node* node = first.root; node; node = node->left.get()) {
+        first.push(node);
+    };
+    return first;
+};
+
+
+// class Persistent_Tree::iterator methods
+
+template<class T, class Compare, class Alloc>
+typename Persistent_Tree<T, Compare, Alloc>::iterator&
+Persistent_Tree<T, Compare, Alloc>::iterator::operator=(
+    const iterator& other) {
+    if(this != &other) {
+        depth = other.depth;
+        root = other.root;
+        std::copy(other.path, other.path + depth, path);
+    };
+    return *this;
+};
+
+// the leftmost node of the right subtree, or up to the first ancestor
+// reached from its left
+template<class T, class Compare, class Alloc>
+typename Persistent_Tree<T, Compare, Alloc>::iterator&
+Persistent_Tree<T, Compare, Alloc>::iterator::operator++() {
+    const Node* node = top();
+    if(node->right) {
+        for(node = node->right.get(); node; node = node->left.get()) {
+            push(node);
+        };
+    } else {
+        do {
+            node = top();
+            depth -= 1;
+        } while(depth != 0 && top()->right.get() == node);
+    };
+    return *this;
+};
+
+// from end() to the last element
+template<class T, class Compare, class Alloc>
+typename Persistent_Tree<T, Compare, Alloc>::iterator&
+Persistent_Tree<T, Compare, Alloc>::iterator::operator--() {
+    const Node* node = (depth == 0) ? root : top()->left.get();
+    if(depth == 0 || node) {
+        for(; node; node = node->right.get()) {
+            push(node);
+        };
+    } else {
+        do {
+            node = top();
+            depth -= 1;
+        } while(depth != 0 && top()->left.get() == node);
+    };
+    return *this;
+};
@@ -0,0 +1,285 @@
+#pragma once
+#include <memory>
+#include <algorithm>
+#include <vector>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+
+// defined below
+template<std::size_t Chunk_Bytes>
+class Slot_Pool;
+
+
+// Fixed-size slot allocator for tree nodes.
+// Single objects are carved out of large chunks and returned slots are kept
+// in a free list, so inserts and erases mostly avoid malloc. Memory goes
+// back to the system only when the last allocator sharing the pool dies.
+// Copies and rebound copies (Pool_Allocator<U> made from this one, as
+// containers do for their node type) share the pool and compare equal;
+// the pool keeps a free list per slot size and alignment.
+// Requests for n != 1 objects are forwarded to std::allocator.
+// Not thread-safe, like the containers using it.
+//
+// Usage: Tree<int, std::less<int>, Pool_Allocator<int>> tree;
+//        Tree<int, std::less<int>, Pool_Allocator<int>>
+//            tree(Pool_Allocator<int>(true)); // huge pages
+template<class T,
+         std::size_t Chunk_Bytes = (std::size_t(1) << 21)
+        >
+class Pool_Allocator {
+ private:
+    using Pool = Slot_Pool<Chunk_Bytes>;
+    using Size_Class = typename Pool::Size_Class;
+
+    template<class U, std::size_t B>
+    friend class Pool_Allocator;
+
+ public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    template<class U>
+    struct rebind { using other = Pool_Allocator<U, Chunk_Bytes>; };
+
+    Pool_Allocator() : Pool_Allocator(false) {};
+    // huge_pages asks for chunks backed by transparent huge pages
+    // (linux only, ignored elsewhere)
+    explicit Pool_Allocator(bool huge_pages)
+        : m_pool(std::make_shared<Pool>(huge_pages)),
+          m_slots(m_pool->size_class(sizeof(T), alignof(T))) {};
+    Pool_Allocator(const Pool_Allocator&) = default;
+
+    // Shares the pool, with the slot size of T
+    template<class U>
+    Pool_Allocator(const Pool_Allocator<U, Chunk_Bytes>& other)
+        : m_pool(other.m_pool),
+          m_slots(m_pool->size_class(sizeof(T), alignof(T))) {};
+
+    Pool_Allocator& operator=(const Pool_Allocator&) = default;
+
+    T* allocate(std::size_t n);
+    void deallocate(T* ptr, std::size_t n);
+
+    // copied containers get a fresh pool instead of sharing this one
+    Pool_Allocator select_on_container_copy_construction() const
+        { return Pool_Allocator(m_pool->huge_pages()); };
+
+    template<class U>
+    bool operator==(const Pool_Allocator<U, Chunk_Bytes>& other) const
+        { return m_pool == other.m_pool; };
+    template<class U>
+    bool operator!=(const Pool_Allocator<U, Chunk_Bytes>& other) const
+        { return m_pool != other.m_pool; };
+
+ private:
+    std::shared_ptr<Pool> m_pool;
+    // the slots of sizeof(T) in m_pool
+    Size_Class* m_slots;
+};
+
+
+// The shared state of a Pool_Allocator and its copies: one Size_Class
+// per slot size and alignment, usually one or two
+template<std::size_t Chunk_Bytes>
+class Slot_Pool {
+ public:
+    class Size_Class;
+
+    explicit Slot_Pool(bool huge_pages) : m_huge_pages(huge_pages) {};
+    Slot_Pool(const Slot_Pool&) = delete;
+    Slot_Pool& operator=(const Slot_Pool&) = delete;
+
+    // found or added
+    Size_Class* size_class(std::size_t object_size,
+                           std::size_t object_align);
+
+    bool huge_pages() const { return m_huge_pages; };
+
+    // Slots of one size and alignment
+    class Size_Class {
+     public:
+        Size_Class(std::size_t object_size, std::size_t object_align,
+                   bool huge_pages);
+        Size_Class(const Size_Class&) = delete;
+        Size_Class& operator=(const Size_Class&) = delete;
+        ~Size_Class();
+
+        void* get_slot();
+        void put_slot(void* slot);
+
+        bool fits(std::size_t object_size, std::size_t object_align) const
+            { return object_size == m_object_size &&
+                     object_align == m_object_align; };
+
+     private:
+        // Chunks are linked through their first bytes, slots follow
+        struct Chunk_Header {
+            Chunk_Header* next;
+        };
+
+        // Free slots are linked through their own memory
+        struct Free_Slot {
+            Free_Slot* next;
+        };
+
+        static constexpr std::size_t mc_huge_page = std::size_t(1) << 21;
+        static constexpr std::size_t mc_first_chunk = std::size_t(1) << 12;
+
+        std::size_t m_object_size;
+        std::size_t m_object_align;
+        // of the slots and of the chunks
+        std::size_t m_align;
+        std::size_t m_slot_size;
+        std::size_t m_slots_offset;
+        bool m_huge_pages;
+
+        Chunk_Header* m_chunks;
+        std::size_t m_next_chunk_bytes;
+
+        Free_Slot* m_free;
+        // untouched tail of the newest chunk
+        char* m_bump;
+        char* m_bump_end;
+
+        void m_new_chunk();
+    };
+
+ private:
+    bool m_huge_pages;
+    std::vector<std::unique_ptr<Size_Class>> m_classes;
+};
+
+
+// class Pool_Allocator methods
+
+template<class T, std::size_t Chunk_Bytes>
+T* Pool_Allocator<T, Chunk_Bytes>::allocate(std::size_t n) {
+    if(n != 1) {
+        return std::allocator<T>().allocate(n);
+    };
+    return static_cast<T*>(m_slots->get_slot());
+};
+
+template<class T, std::size_t Chunk_Bytes>
+void Pool_Allocator<T, Chunk_Bytes>::deallocate(T* ptr, std::size_t n) {
+    if(n != 1) {
+        std::allocator<T>().deallocate(ptr, n);
+        return;
+    };
+    m_slots->put_slot(ptr);
+};
+
+
+// class Slot_Pool methods
+
+template<std::size_t Chunk_Bytes>
+typename Slot_Pool<Chunk_Bytes>::Size_Class*
+Slot_Pool<Chunk_Bytes>::size_class(std::size_t object_size,
+                                   std::size_t object_align) {
+    for(const auto& slots : m_classes) {
+        if(slots->fits(object_size, object_align)) {
+            return slots.get();
+        };
+    };
+    m_classes.push_back(std::make_unique<Size_Class>(
+        object_size, object_align, m_huge_pages));
+    return m_classes.back().get();
+};
+
+
+// class Slot_Pool::Size_Class methods
+
+template<std::size_t Chunk_Bytes>
+Slot_Pool<Chunk_Bytes>::Size_Class::Size_Class(
+    std::size_t object_size, std::size_t object_align, bool huge_pages)
+    : m_object_size(object_size), m_object_align(object_align),
+      m_huge_pages(huge_pages), m_chunks(nullptr),
+      m_free(nullptr), m_bump(nullptr), m_bump_end(nullptr) {
+    m_align = std::max({object_align, alignof(Free_Slot),
+                        alignof(Chunk_Header)});
+    m_slot_size = std::max(object_size, sizeof(Free_Slot));
+    m_slot_size = (m_slot_size + m_align - 1) / m_align * m_align;
+    m_slots_offset =
+        (sizeof(Chunk_Header) + m_align - 1) / m_align * m_align;
+    // huge-page chunks are aligned to a huge page only
+    m_huge_pages = m_huge_pages && m_align <= mc_huge_page;
+    // huge pages are only worth it for whole huge-page chunks
+    m_next_chunk_bytes = m_huge_pages ? Chunk_Bytes : mc_first_chunk;
+    if(m_next_chunk_bytes < m_slots_offset + m_slot_size) {
+        m_next_chunk_bytes = m_slots_offset + m_slot_size;
+    };
+};
+
+template<std::size_t Chunk_Bytes>
+Slot_Pool<Chunk_Bytes>::Size_Class::~Size_Class() {
+    while(m_chunks) {
+        Chunk_Header* next = m_chunks->next;
+        if(m_huge_pages) {
+            std::free(m_chunks);
+        } else {
+            ::operator delete(m_chunks, std::align_val_t(m_align));
+        };
+        m_chunks = next;
+    };
+};
+
+template<std::size_t Chunk_Bytes>
+void* Slot_Pool<Chunk_Bytes>::Size_Class::get_slot() {
+    if(m_free) {
+        Free_Slot* slot = m_free;
+        m_free = slot->next;
+        return slot;
+    };
+    if(m_bump_end - m_bump < static_cast<std::ptrdiff_t>(m_slot_size)) {
+        m_new_chunk();
+    };
+    void* slot = m_bump;
+    m_bump += m_slot_size;
+    return slot;
+};
+
+template<std::size_t Chunk_Bytes>
+void Slot_Pool<Chunk_Bytes>::Size_Class::put_slot(void* slot) {
+    Free_Slot* freed = static_cast<Free_Slot*>(slot);
+    freed->next = m_free;
+    m_free = freed;
+};
+
+// Chunks double in size up to Chunk_Bytes, so small trees stay small.
+// A chunk is aligned for the slots, which start at a multiple of m_align
+// and are m_align apart.
+template<std::size_t Chunk_Bytes>
+void Slot_Pool<Chunk_Bytes>::Size_Class::m_new_chunk() {
+    std::size_t bytes = m_next_chunk_bytes;
+    void* memory = nullptr;
+    if(m_huge_pages) {
+        bytes = (bytes + mc_huge_page - 1) / mc_huge_page * mc_huge_page;
+        memory = std::aligned_alloc(mc_huge_page, bytes);
+        if(!memory) {
+            throw std::bad_alloc();
+        };
+#ifdef __linux__
+        madvise(memory, bytes, MADV_HUGEPAGE);
+#endif
+    } else {
+        memory = ::operator new(bytes, std::align_val_t(m_align));
+    };
+
+    Chunk_Header* chunk = static_cast<Chunk_Header*>(memory);
+    chunk->next = m_chunks;
+    m_chunks = chunk;
+    m_bump = static_cast<char*>(memory) + m_slots_offset;
+    m_bump_end = static_cast<char*>(memory) + bytes;
+
+    if(m_next_chunk_bytes < Chunk_Bytes) {
+        m_next_chunk_bytes = std::min(2 * m_next_chunk_bytes, Chunk_Bytes);
+    };
+};
@@ -6,7 +6,9 @@
 #include <random>
 
 #include "Tree.cpp"
+#include "Pool_Allocator.h"
 #include "RBTree.h"
+#include "BTree.h"
 
 // memory leaks
 /*
@@ -52,6 +54,9 @@ int main() {
 
     // choose testing variant of set
     using My_set = std::set<int>;
+    // using My_set = Tree<int, std::less<int>, Pool_Allocator<int>>;
+    // using My_set = RBTree<int>;
+    // using My_set = BTree<int>;
 
     bool methods_correctness(1);
 
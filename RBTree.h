@@ -1,20 +1,91 @@
 #pragma once
 #include <iostream>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include "Three_Way.h"
 #define BLACK 0
 #define RED 1
+/*The comparator is kept per tree, empty ones take no space.
+One with compare(a, b) (see Three_Way.h) is called once per level by insert and find*/
 template <class T, class Compare = std::less<T>>
-class RBTree {
+class RBTree : private Compare_Holder<Compare> {
+private:
+	class Chain;
 public:
+	class iterator;
+	using const_iterator = iterator;
+	using reverse_iterator = std::reverse_iterator<iterator>;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
 	RBTree();
+	explicit RBTree(const Compare& comp);
+	/*Bulk load, see assign*/
+	template <class InputIt>
+	RBTree(InputIt first, InputIt last);
+	template <class InputIt>
+	RBTree(InputIt first, InputIt last, const Compare& comp);
 	RBTree(const RBTree&);
 	RBTree& operator=(const RBTree& tree);
 	RBTree(RBTree&&) noexcept;
 	RBTree& operator=(RBTree&&) noexcept;
 	~RBTree();
-	void insert(const T& key);
+	/*Replaces the content with [first, last). Sorted input is built in O(n)
+	with direct coloring, unsorted input is sorted first. Duplicates are dropped*/
+	template <class InputIt>
+	void assign(InputIt first, InputIt last);
+	std::pair<iterator, bool> insert(const T& key);
 	void erase(const T& key);
-	bool find(const T& key);
-	int32_t size();
+	iterator find(const T& key) const;
+	/*Heterogeneous lookup, only with a transparent comparator (std::less<> etc.).
+	Takes any key the comparator accepts, no temporary T is built.
+	erase removes every element equivalent to key*/
+	template <class Key, class C = Compare, class = typename C::is_transparent>
+	void erase(const Key& key);
+	template <class Key, class C = Compare, class = typename C::is_transparent>
+	iterator find(const Key& key) const;
+	/*First element not less than key*/
+	iterator lower_bound(const T& key) const;
+	/*First element greater than key*/
+	iterator upper_bound(const T& key) const;
+	int32_t size() const;
+	bool empty() const;
+	Compare key_comp() const { return comp(); }
+
+	iterator begin() const;
+	iterator end() const;
+	const_iterator cbegin() const { return begin(); }
+	const_iterator cend() const { return end(); }
+	reverse_iterator rbegin() const { return reverse_iterator(end()); }
+	reverse_iterator rend() const { return reverse_iterator(begin()); }
+
+	/*Bidirectional in-order iterator. Past-the-end is a null chain,
+	++ from it gives begin(), -- gives the last element*/
+	class iterator
+	{
+	public:
+		using iterator_category = std::bidirectional_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const T*;
+		using reference = const T&;
+
+		iterator();
+		iterator(Chain*, const RBTree*);
+
+		const T& operator*() const;
+		const T* operator->() const;
+		iterator& operator++();
+		iterator operator++(int);
+		iterator& operator--();
+		iterator operator--(int);
+		bool operator==(const iterator&) const;
+		bool operator!=(const iterator&) const;
+	private:
+		Chain* chain_;
+		const RBTree* tree_;
+	};
 private:
 	void test();
 	int32_t height()
@@ -29,34 +100,27 @@ private:
 	enum class Flags {
 		LEAF
 	};
+	/*Chains don't own their childs, the tree frees them.
+	Missing childs point to the tree's nil_ sentinel, not to nullptr*/
 	class Chain
 	{
 	public:
-		/*DO NOT FORGET TO INIT PARENT!!!*/
-		Chain();
-
-		/*DO NOT FORGET TO INIT PARENT!!!*/
+		/*DO NOT FORGET TO INIT PARENT AND CHILDS!!!*/
 		Chain(const T&);
+		Chain(T&&);
 
-		/*DO NOT FORGET TO INIT PARENT!!!*/
-		Chain(const Chain&);
-
-		/*DO NOT FORGET TO INIT PARENT!!!*/
+		/*Black sentinel, all links are nullptr*/
 		Chain(const Flags&);
 
-		Chain& operator=(const Chain&);
-
-		/*DO NOT FORGET TO INIT PARENT!!!*/
-		Chain(Chain&&) noexcept;
-
-		Chain& operator=(Chain&&) noexcept;
-		~Chain();
+		Chain(const Chain&) = delete;
+		Chain& operator=(const Chain&) = delete;
 		Chain* right, *left, *parent;
 		T value;
 		/*true - red, false - black*/
-		bool color, isLeaf;
+		bool color;
 	};
-	Chain* BST_insert(const T&);
+	/*Returns the new chain and true, or the equal chain and false*/
+	std::pair<Chain*, bool> BST_insert(const T&);
 	void rotate_left(Chain*);
 	void rotate_right(Chain*);
 	void rotate_LR(Chain*);
@@ -64,10 +128,23 @@ private:
 	void ins_balance(Chain*);
 	void erase_balance(Chain*, Chain*);
 	void erase_chain(Chain*);
-	Chain* find_chain(const T&);
-	Chain* min_value(Chain*);
+	template <class Key>
+	Chain* find_chain(const Key&) const;
+	Chain* min_value(Chain*) const;
+	Chain* max_value(Chain*) const;
+	Chain* copy_subtree(const Chain*, const Chain*, Chain*);
+	Chain* build_subtree(std::vector<T>&, size_t, size_t, int32_t, int32_t, Chain*);
+	void destroy_subtree(Chain*);
+	/*Gives a moved-from tree its sentinel back*/
+	void make_nil();
+	void replace_chain(Chain*, Chain*);
+	void swap_with_min(Chain*, Chain*);
 	Chain* root_;
-	static Compare comp_;
+	/*Shared black leaf of the whole tree, nullptr (as root_) after a move*/
+	Chain* nil_;
+	/*Number of elements, kept by insert and erase*/
+	int32_t size_;
+	const Compare& comp() const { return this->comparator(); }
 
 	template <class U, class Comp>
 	friend std::ostream& operator<< (std::ostream& out, const RBTree<U, Comp>& tree);
@@ -140,4 +217,5 @@ private:
 	}*/
 };
 #include "RBTree.inl"
-#include "Chain.inl"
\ No newline at end of file
+#include "Chain.inl"
+#include "Iterator.inl"
\ No newline at end of file
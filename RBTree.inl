@@ -4,18 +4,35 @@
 #include <utility>
 /*--------------------------Constructors and distructor ----------------*/
 template <class T, class Compare>
-RBTree<T, Compare>::RBTree()
+RBTree<T, Compare>::RBTree() : nil_(new Chain(Flags::LEAF)), size_(0)
 {
-	root_ = new Chain(Flags::LEAF);
+	root_ = nil_;
 }
 
 template <class T, class Compare>
-RBTree<T, Compare>::RBTree(const RBTree& other) 
+RBTree<T, Compare>::RBTree(const Compare& comp) : Compare_Holder<Compare>(comp), nil_(new Chain(Flags::LEAF)), size_(0)
 {
-	if(root_!=nullptr) {
-		delete root_;
-	}
-	root_ = new typename RBTree<T, Compare>::Chain(*other.root_);
+	root_ = nil_;
+}
+
+template <class T, class Compare>
+template <class InputIt>
+RBTree<T, Compare>::RBTree(InputIt first, InputIt last) : RBTree()
+{
+	assign(first, last);
+}
+
+template <class T, class Compare>
+template <class InputIt>
+RBTree<T, Compare>::RBTree(InputIt first, InputIt last, const Compare& comp) : RBTree(comp)
+{
+	assign(first, last);
+}
+
+template <class T, class Compare>
+RBTree<T, Compare>::RBTree(const RBTree& other) : Compare_Holder<Compare>(other), nil_(new Chain(Flags::LEAF)), size_(other.size_)
+{
+	root_ = copy_subtree(other.root_, other.nil_, nullptr);
 }
 
 template <class T, class Compare>
@@ -24,21 +41,22 @@ RBTree<T, Compare>& RBTree<T, Compare>::operator=(const RBTree& other)
 	if (&other == this) {
 		return *this;
 	}
-	if (root_ != nullptr) {
-		delete root_;
-	}
-	root_ = new typename RBTree<T, Compare>::Chain(*other.root_);
+	make_nil();
+	destroy_subtree(root_);
+	Compare_Holder<Compare>::operator=(other);
+	root_ = copy_subtree(other.root_, other.nil_, nullptr);
+	size_ = other.size_;
 	return *this;
 }
 
 template <class T, class Compare>
-RBTree<T, Compare>::RBTree(RBTree&& other) noexcept
+RBTree<T, Compare>::RBTree(RBTree&& other) noexcept : Compare_Holder<Compare>(other), root_(other.root_), nil_(other.nil_), size_(other.size_)
 {
-	if (root_ != nullptr) {
-		delete root_;
-	}
-	root_ = other.root_;
+	/*The moved-from tree is empty without a sentinel (root_ == nil_ == nullptr),
+	so moving allocates nothing; make_nil gives it one when it is changed again*/
+	other.nil_ = nullptr;
 	other.root_ = nullptr;
+	other.size_ = 0;
 }
 
 template <class T, class Compare>
@@ -48,45 +66,187 @@ RBTree<T, Compare>& RBTree<T, Compare>::operator=(RBTree&& other) noexcept
 		return *this;
 	}
 
-	if (root_ != nullptr) {
-		delete root_;
-	}
-	root_ = other.root_;
-	other.root_ = nullptr;
+	/*Swapping leaves other with this tree's chains and sentinel, it frees them*/
+	Compare_Holder<Compare>::operator=(other);
+	std::swap(root_, other.root_);
+	std::swap(nil_, other.nil_);
+	std::swap(size_, other.size_);
 	return *this;
 }
 
 template <class T, class Compare>
 RBTree<T, Compare>::~RBTree() {
-	if (root_ != nullptr) {
-		delete root_;
+	destroy_subtree(root_);
+	delete nil_;
+}
+
+template <class T, class Compare>
+void RBTree<T, Compare>::make_nil()
+{
+	if (nil_ == nullptr) {
+		nil_ = new Chain(Flags::LEAF);
+		root_ = nil_;
+	}
+}
+
+template <class T, class Compare>
+typename RBTree<T, Compare>::Chain* RBTree<T, Compare>::copy_subtree(const Chain* subTree, const Chain* otherNil, Chain* parent)
+{
+	if (subTree == otherNil) {
+		return nil_;
+	}
+	Chain* chain = new Chain(subTree->value);
+	chain->color = subTree->color;
+	chain->parent = parent;
+	chain->left = copy_subtree(subTree->left, otherNil, chain);
+	chain->right = copy_subtree(subTree->right, otherNil, chain);
+	return chain;
+}
+
+/*Perfectly balanced tree of count values starting from first. All chains are
+black except the bottom level when it isn't full (redDepth), so every path
+has the same number of black chains. Values are moved out of the buffer*/
+template <class T, class Compare>
+typename RBTree<T, Compare>::Chain* RBTree<T, Compare>::build_subtree(std::vector<T>& values, size_t first, size_t count, int32_t depth, int32_t redDepth, Chain* parent)
+{
+	if (count == 0) {
+		return nil_;
+	}
+	size_t leftCount = count / 2;
+	Chain* chain = new Chain(std::move(values[first + leftCount]));
+	chain->parent = parent;
+	chain->color = (depth == redDepth) ? RED : BLACK;
+	chain->left = build_subtree(values, first, leftCount, depth + 1, redDepth, chain);
+	chain->right = build_subtree(values, first + leftCount + 1, count - leftCount - 1, depth + 1, redDepth, chain);
+	return chain;
+}
+
+template <class T, class Compare>
+void RBTree<T, Compare>::destroy_subtree(Chain* subTree)
+{
+	if (subTree != nil_) {
+		destroy_subtree(subTree->left);
+		destroy_subtree(subTree->right);
+		delete subTree;
 	}
 }
 /*---------------------Modifing functions-----------------------------*/
 
 template <class T, class Compare>
-typename RBTree<T, Compare>::Chain* RBTree<T, Compare>::BST_insert(const T& key)
+template <class InputIt>
+void RBTree<T, Compare>::assign(InputIt first, InputIt last)
+{
+	std::vector<T> values(first, last);
+	const Compare& comp = this->comp();
+	if (!std::is_sorted(values.begin(), values.end(), comp)) {
+		std::sort(values.begin(), values.end(), comp);
+	}
+	values.erase(std::unique(values.begin(), values.end(), [&comp](const T& a, const T& b) {
+		return !comp(a, b);
+	}), values.end());
+
+	/*levels - height of the balanced tree, its bottom level is red if it isn't full*/
+	int32_t levels = 0;
+	while ((size_t(1) << levels) - 1 < values.size()) {
+		++levels;
+	}
+	int32_t redDepth = -1;
+	if ((size_t(1) << levels) - 1 != values.size()) {
+		redDepth = levels - 1;
+	}
+
+	make_nil();
+	Chain* newRoot = build_subtree(values, 0, values.size(), 0, redDepth, nullptr);
+	destroy_subtree(root_);
+	root_ = newRoot;
+	size_ = static_cast<int32_t>(values.size());
+}
+
+template <class T, class Compare>
+std::pair<typename RBTree<T, Compare>::Chain*, bool> RBTree<T, Compare>::BST_insert(const T& key)
 {
+	Chain* parent = nullptr;
 	Chain* ptr = root_;
-	while (!(ptr->isLeaf)) {
-		if (!comp_(key, ptr->value) && !comp_(ptr->value, key)) {
-			return nullptr;	//The object already exists
-		}
-		if (comp_(key,ptr->value)) {
+	bool isLeft = false;
+	while (ptr != nil_) {
+		/*one three-way comparison decides between equal, left and right*/
+		int order = three_way_compare(comp(), key, ptr->value);
+		if (order == 0) {
+			return std::make_pair(ptr, false);	//The object already exists
+		}
+		parent = ptr;
+		isLeft = order < 0;
+		if (isLeft) {
 			ptr = ptr->left;
 		}
 		else {
 			ptr = ptr->right;
 		}
 	}
-	(*ptr) = std::move(Chain(key));
-	return ptr;
+	ptr = new Chain(key);
+	++size_;
+	ptr->left = ptr->right = nil_;
+	ptr->parent = parent;
+	if (parent == nullptr) {
+		root_ = ptr;
+	}
+	else if (isLeft) {
+		parent->left = ptr;
+	}
+	else {
+		parent->right = ptr;
+	}
+	return std::make_pair(ptr, true);
+}
+
+/*Puts newChain (nil_ allowed) in place of chain under chain's parent*/
+template <class T, class Compare>
+void RBTree<T, Compare>::replace_chain(Chain* chain, Chain* newChain)
+{
+	if (chain->parent == nullptr) {
+		root_ = newChain;
+	}
+	else if (chain->parent->left == chain) {
+		chain->parent->left = newChain;
+	}
+	else {
+		chain->parent->right = newChain;
+	}
+	newChain->parent = chain->parent;
+}
+
+/*Exchanges the places and colors of chain and min, the leftmost chain of
+chain's right subtree. Chain ends up with no left child*/
+template <class T, class Compare>
+void RBTree<T, Compare>::swap_with_min(Chain* chain, Chain* min)
+{
+	Chain* minParent = min->parent;
+	Chain* minRight = min->right;
+	std::swap(chain->color, min->color);
+	replace_chain(chain, min);
+	min->left = chain->left;
+	min->left->parent = min;
+	if (minParent == chain) {
+		min->right = chain;
+		chain->parent = min;
+	}
+	else {
+		min->right = chain->right;
+		min->right->parent = min;
+		minParent->left = chain;
+		chain->parent = minParent;
+	}
+	chain->left = nil_;
+	chain->right = minRight;
+	if (minRight != nil_) {
+		minRight->parent = chain;
+	}
 }
 
 template <class T, class Compare>
 void RBTree<T, Compare>::rotate_left(Chain* subTree)
 {
-	if (subTree->right->isLeaf) {
+	if (subTree->right == nil_) {
 		throw "Invailed left rotation!";
 	}
 	Chain* newChain = subTree->right;
@@ -114,7 +274,7 @@ void RBTree<T, Compare>::rotate_left(Chain* subTree)
 template <class T, class Compare>
 void RBTree<T, Compare>::rotate_right(Chain* subTree)
 {
-	if (subTree->left->isLeaf) {
+	if (subTree->left == nil_) {
 		throw "Invailed right rotation!";
 	}
 	Chain* newChain = subTree->left;
@@ -154,16 +314,15 @@ void RBTree<T, Compare>::rotate_RL(Chain* subTree)
 }
 
 template <class T, class Compare>
-void RBTree<T, Compare>::insert(const T& key)
+std::pair<typename RBTree<T, Compare>::iterator, bool> RBTree<T, Compare>::insert(const T& key)
 {
-	Chain* insertedChain = BST_insert(key);
-	if (insertedChain==nullptr) {
-		return;
-	}
-	else {
-		ins_balance(insertedChain);
+	make_nil();
+	std::pair<Chain*, bool> inserted = BST_insert(key);
+	if (inserted.second) {
+		/*Rotations relink chains, the inserted one keeps its value*/
+		ins_balance(inserted.first);
 	}
-
+	return std::make_pair(iterator(inserted.first, this), inserted.second);
 }
 
 template <class T, class Compare>
@@ -172,6 +331,7 @@ void RBTree<T, Compare>::erase(const T& key)
 	Chain* chainToDel = find_chain(key);
 	if (chainToDel != nullptr) {
 		erase_chain(chainToDel);
+		--size_;
 	}
 }
 
@@ -179,54 +339,56 @@ template <class T, class Compare>
 void RBTree<T, Compare>::erase_chain(Chain* chain)
 {
 	/*-------------------Case 1-----------------------
-	-----Chain has 2 childs. Finding min value--------
-	--------in right subtree, swap, and delete--------*/
-	if (!chain->left->isLeaf && !chain->right->isLeaf) {
-		Chain* min = min_value(chain->right);
-		std::swap(chain->value, min->value);
-		erase_chain(min);
+	-----Chain has 2 childs. Relinking it with the----
+	--min chain of right subtree, and delete there----
+	----(values stay in their chains, so iterators----
+	-----------to other elements stay valid)---------*/
+	if (chain->left != nil_ && chain->right != nil_) {
+		swap_with_min(chain, min_value(chain->right));
+		erase_chain(chain);
 		return;
 	}
 	/*-------------------Case 2----------------------
 	----- Black chain with 1 child. Child must be----
-	---red chain without childs. Moving red child ---
-	--------------data to this chain----------------*/
-	if (chain->color==BLACK && (chain->left->isLeaf != chain->right->isLeaf)) {
-		if (!chain->left->isLeaf) {
-			chain->value = chain->left->value;
-			*(chain->left) = std::move(Chain(Flags::LEAF));
-		}
-		else {
-			chain->value = chain->right->value;
-			*(chain->right) = std::move(Chain(Flags::LEAF));
-		}
+	---red chain without childs. Putting the child---
+	-----------in place, painting it black-----------*/
+	if (chain->color==BLACK && ((chain->left == nil_) != (chain->right == nil_))) {
+		Chain* child = (chain->left != nil_) ? chain->left : chain->right;
+		replace_chain(chain, child);
+		child->color = BLACK;
+		delete chain;
 		return;
 	}
 	/*-------------------Case 3----------------------
 	--------- Red chain without childs. -------------
 	------------Just removing this chain-------------*/
-	if (chain->color == RED && (chain->left->isLeaf && chain->right->isLeaf)) {
-		*(chain) = std::move(Chain(Flags::LEAF));
+	if (chain->color == RED && (chain->left == nil_ && chain->right == nil_)) {
+		replace_chain(chain, nil_);
+		delete chain;
 		return;
 	}
 	/*--------------------Case 4-----------------------
 	--Black chain without child. Remove and BALANCE!!!--*/
-	if (chain->color == BLACK && (chain->left->isLeaf && chain->right->isLeaf)) {
-		*(chain) = std::move(Chain(Flags::LEAF));
-		erase_balance(chain->parent, chain);
+	if (chain->color == BLACK && (chain->left == nil_ && chain->right == nil_)) {
+		Chain* parent = chain->parent;
+		replace_chain(chain, nil_);
+		delete chain;
+		erase_balance(parent, nil_);
 		return;
 	}
 }
 
 template <class T, class Compare>
-typename RBTree<T, Compare>::Chain* RBTree<T, Compare>::find_chain(const T& key)
+template <class Key>
+typename RBTree<T, Compare>::Chain* RBTree<T, Compare>::find_chain(const Key& key) const
 {
 	Chain* ptr = root_;
-	while (!ptr->isLeaf) {
-		if (!comp_(key, ptr->value) && !comp_(ptr->value, key)) {
+	while (ptr != nil_) {
+		int order = three_way_compare(comp(), key, ptr->value);
+		if (order == 0) {
 			return ptr;
 		}
-		if (comp_(key, ptr->value)) {
+		if (order < 0) {
 			ptr = ptr->left;
 		}
 		else {
@@ -237,15 +399,77 @@ typename RBTree<T, Compare>::Chain* RBTree<T, Compare>::find_chain(const T& key)
 }
 
 template <class T, class Compare>
-bool RBTree<T, Compare>::find(const T& key)
+typename RBTree<T, Compare>::iterator RBTree<T, Compare>::find(const T& key) const
 {
-	Chain* ptr = find_chain(key);
-	if (ptr == nullptr) {
-		return false;
+	return iterator(find_chain(key), this);
+}
+
+template <class T, class Compare>
+template <class Key, class C, class>
+void RBTree<T, Compare>::erase(const Key& key)
+{
+	Chain* chainToDel = find_chain(key);
+	while (chainToDel != nullptr) {
+		erase_chain(chainToDel);
+		--size_;
+		chainToDel = find_chain(key);
 	}
-	else {
-		return true;
+}
+
+template <class T, class Compare>
+template <class Key, class C, class>
+typename RBTree<T, Compare>::iterator RBTree<T, Compare>::find(const Key& key) const
+{
+	return iterator(find_chain(key), this);
+}
+
+template <class T, class Compare>
+typename RBTree<T, Compare>::iterator RBTree<T, Compare>::lower_bound(const T& key) const
+{
+	Chain* res = nullptr;
+	Chain* ptr = root_;
+	while (ptr != nil_) {
+		if (!comp()(ptr->value, key)) {
+			res = ptr;
+			ptr = ptr->left;
+		}
+		else {
+			ptr = ptr->right;
+		}
+	}
+	return iterator(res, this);
+}
+
+template <class T, class Compare>
+typename RBTree<T, Compare>::iterator RBTree<T, Compare>::upper_bound(const T& key) const
+{
+	Chain* res = nullptr;
+	Chain* ptr = root_;
+	while (ptr != nil_) {
+		if (comp()(key, ptr->value)) {
+			res = ptr;
+			ptr = ptr->left;
+		}
+		else {
+			ptr = ptr->right;
+		}
 	}
+	return iterator(res, this);
+}
+
+template <class T, class Compare>
+typename RBTree<T, Compare>::iterator RBTree<T, Compare>::begin() const
+{
+	if (root_ == nil_) {
+		return end();
+	}
+	return iterator(min_value(root_), this);
+}
+
+template <class T, class Compare>
+typename RBTree<T, Compare>::iterator RBTree<T, Compare>::end() const
+{
+	return iterator(nullptr, this);
 }
 
 template <class T, class Compare>
@@ -557,9 +781,9 @@ void RBTree<T, Compare>::erase_balance(Chain* subTree, Chain* caller)
 }
 
 template <class T, class Compare>
-typename RBTree<T, Compare>::Chain* RBTree<T, Compare>::min_value(Chain* subTree)
+typename RBTree<T, Compare>::Chain* RBTree<T, Compare>::min_value(Chain* subTree) const
 {
-	if (subTree->left->isLeaf) {
+	if (subTree->left == nil_) {
 		return subTree;
 	}
 	else {
@@ -568,48 +792,38 @@ typename RBTree<T, Compare>::Chain* RBTree<T, Compare>::min_value(Chain* subTree
 }
 
 template <class T, class Compare>
-int32_t RBTree<T, Compare>::size() 
+typename RBTree<T, Compare>::Chain* RBTree<T, Compare>::max_value(Chain* subTree) const
 {
-	int32_t res = 0;
-	std::queue<Chain*> q;
-	q.push(root_);
-	Chain* ptr = nullptr;
-	while (!q.empty())
-	{
-		ptr = q.front();
-		q.pop();
-		if (!(ptr->isLeaf)) {
-			++res;
-			q.push(ptr->left);
-			q.push(ptr->right);
-		}
+	if (subTree->right == nil_) {
+		return subTree;
+	}
+	else {
+		return max_value(subTree->right);
 	}
-	return res;
+}
+
+template <class T, class Compare>
+int32_t RBTree<T, Compare>::size() const
+{
+	return size_;
+}
+
+template <class T, class Compare>
+bool RBTree<T, Compare>::empty() const
+{
+	return size_ == 0;
 }
 
 template <class T, class Compare>
 void RBTree<T, Compare>::test() {
-	*(root_) = std::move(Chain(7));
-	root_->color = BLACK;
-	*(root_->right) = std::move(Chain(8));
+	insert(7);
+	insert(8);
+	insert(3);
 	root_->right->color = BLACK;
-	*(root_->left) = std::move(Chain(3));
 	root_->left->color = BLACK;
-
-	/**(root_->left->left) = std::move(Chain(2));
-	//root_->left->left->color = BLACK;
-	*(root_->left->right) = std::move(Flags::LEAF);
-	//root_->left->right->color = RED;
-
-	/**(root_->left->right->left) = std::move(Chain(Flags::LEAF));
-	*(root_->left->right->right) = std::move(Chain(6));*/
 	erase(8);
 }
 
-/*-------------------Static members------------------------------------*/
-template <class T, class Compare>
-Compare RBTree<T, Compare>::comp_ = Compare();
-
 /*--------------------------I/O-------------------------------*/
 template <class T, class Compare>
 std::ostream& operator<<(std::ostream& out, const RBTree<T, Compare>& tree)
@@ -623,7 +837,7 @@ std::ostream& operator<<(std::ostream& out, const RBTree<T, Compare>& tree)
 		q.pop();
 		if (ptr != nullptr) {
 			std::cout << "----------"<<'\n';
-			if (ptr->isLeaf) {
+			if (ptr == tree.nil_) {
 				std::cout << "Leaf" << '\n';
 			}
 			else {
@@ -0,0 +1,94 @@
+#pragma once
+#include <type_traits>
+#include <utility>
+
+
+// Three-way comparison for the trees.
+// A comparator may define compare(a, b) returning a negative value, zero
+// or a positive value (or an ordering of operator<=>), like
+// std::string::compare. The trees then tell left, right and equal apart
+// with one call per level instead of two (three in RBTree).
+// Comparators with operator() only work as before.
+//
+// Usage: Tree<std::string, Three_Way_Less> tree;
+
+// Transparent less with compare(): a.compare(b) when the key has one
+// (std::string, std::string_view), a <=> b in C++20, two < otherwise
+struct Three_Way_Less {
+    using is_transparent = void;
+
+    template<class A, class B>
+    bool operator()(const A& a, const B& b) const { return a < b; };
+    template<class A, class B>
+    int compare(const A& a, const B& b) const
+        { return m_compare(a, b, Member_Tag()); };
+
+ private:
+    // overload preference, the most derived tag wins
+    struct Less_Tag {};
+    struct Spaceship_Tag : Less_Tag {};
+    struct Member_Tag : Spaceship_Tag {};
+
+    template<class A, class B>
+    static auto m_compare(const A& a, const B& b, Member_Tag)
+        -> decltype(int(a.compare(b))) { return a.compare(b); };
+#if defined(__cpp_impl_three_way_comparison)
+    template<class A, class B>
+    static auto m_compare(const A& a, const B& b, Spaceship_Tag)
+        -> decltype((a <=> b) < 0, int())
+        { auto order = a <=> b; return (order < 0) ? -1 : (0 < order); };
+#endif
+    template<class A, class B>
+    static int m_compare(const A& a, const B& b, Less_Tag)
+        { return (a < b) ? -1 : (b < a); };
+};
+
+
+// true if Compare has compare(a, b) for these argument types
+template<class Compare, class A, class B, class = void>
+struct Has_Three_Way : std::false_type {};
+
+template<class Compare, class A, class B>
+struct Has_Three_Way<Compare, A, B,
+    std::void_t<decltype(std::declval<const Compare&>().compare(
+        std::declval<const A&>(), std::declval<const B&>()))>>
+    : std::true_type {};
+
+// -1, 0 or 1 as a is less, equivalent or greater than b: one call of
+// compare.compare() when there is one, up to two of compare() otherwise
+template<class Compare, class A, class B>
+int three_way_compare(const Compare& compare, const A& a, const B& b) {
+    if constexpr(Has_Three_Way<Compare, A, B>::value) {
+        auto order = compare.compare(a, b);
+        return (order < 0) ? -1 : (0 < order);
+    } else {
+        return compare(a, b) ? -1 : int(compare(b, a));
+    };
+};
+
+
+// Keeps the comparator of a container. Empty comparators (std::less etc.)
+// become an empty base and take no space, others are a member.
+template<class Compare,
+         bool = std::is_empty<Compare>::value &&
+                !std::is_final<Compare>::value
+        >
+class Compare_Holder : private Compare {
+ public:
+    Compare_Holder() : Compare() {};
+    explicit Compare_Holder(const Compare& compare) : Compare(compare) {};
+
+    const Compare& comparator() const { return *this; };
+};
+
+template<class Compare>
+class Compare_Holder<Compare, false> {
+ public:
+    Compare_Holder() : m_compare() {};
+    explicit Compare_Holder(const Compare& compare) : m_compare(compare) {};
+
+    const Compare& comparator() const { return m_compare; };
+
+ private:
+    Compare m_compare;
+};
@@ -1,52 +1,247 @@
 #include <memory>
 #include <iostream>
 #include <deque>
+#include <iterator>
+#include <vector>
+#include <algorithm>
+#include <future>
+#include <thread>
+#include <type_traits>
+#include <limits>
+#include <optional>
+
+#include "Three_Way.h"
+#include "Frozen_Tree.h"
+#include "Persistent_Tree.h"
+
+
+// Aggregation policies for Tree. A policy defines value_type, 
+// project() turning a key into value_type, associative combine() and 
+// its identity(). No_Aggregate turns the per-node aggregate off.
+struct No_Aggregate {};
+
+template<class T>
+struct Sum_Aggregate {
+    using value_type = T;
+    static T project(const T& key) { return key; };
+    static T combine(const T& a, const T& b) { return a + b; };
+    static T identity() { return T(); };
+};
+
+template<class T>
+struct Min_Aggregate {
+    using value_type = T;
+    static T project(const T& key) { return key; };
+    static T combine(const T& a, const T& b) { return (b < a) ? b : a; };
+    static T identity() { return std::numeric_limits<T>::max(); };
+};
+
+template<class T>
+struct Max_Aggregate {
+    using value_type = T;
+    static T project(const T& key) { return key; };
+    static T combine(const T& a, const T& b) { return (a < b) ? b : a; };
+    static T identity() { return std::numeric_limits<T>::lowest(); };
+};
 
 
+// Order_Statistics keeps subtree sizes in the nodes for rank() and 
+// select(), Aggregate policy keeps subtree aggregates for aggregate(). 
+// The nodes stay smaller without them.
+// The comparator is kept per tree (no space if it is empty), one with 
+// compare(a, b) (see Three_Way.h) makes every descent compare once 
+// per level.
 template<class T, 
          class Compare=std::less<T>, 
-         class Alloc=std::allocator<T>
+         class Alloc=std::allocator<T>, 
+         bool Order_Statistics=false, 
+         class Aggregate=No_Aggregate
         >
-class Tree {
+class Tree : private Compare_Holder<Compare> {
  private:
     struct Node;
     class iterator;
+    class Node_Handle;
+    struct Insert_Return;
 
-    using Node_Ptr = std::shared_ptr<Node>;
-    using Weak_Node_Ptr = std::weak_ptr<Node>;
+    using Node_Alloc = 
+        typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+    using Node_Alloc_Traits = std::allocator_traits<Node_Alloc>;
     using Result_Pair = std::pair<iterator, bool>;
+    using Compare_Base = Compare_Holder<Compare>;
 
  public:
     using const_iterator = iterator;
+    using node_type = Node_Handle;
+    using insert_return_type = Insert_Return;
     using reverse_iterator = std::reverse_iterator<iterator>;
     using const_reverse_iterator = std::reverse_iterator<const_iterator>;
 
-    Tree() : m_size(0) {};
+    Tree() : m_root(nullptr), m_size(0) {};
+    explicit Tree(const Alloc& alloc) 
+        : m_node_allocator(alloc), m_root(nullptr), m_size(0) {};
+    explicit Tree(const Compare& compare, const Alloc& alloc = Alloc()) 
+        : Compare_Base(compare), m_node_allocator(alloc), 
+          m_root(nullptr), m_size(0) {};
+    template<class InputIt>
+    Tree(InputIt first, InputIt last, const Alloc& alloc = Alloc())
+        : m_node_allocator(alloc), m_root(nullptr), m_size(0) 
+        { assign(first, last); };
+    template<class InputIt>
+    Tree(InputIt first, InputIt last, const Compare& compare, 
+         const Alloc& alloc = Alloc())
+        : Compare_Base(compare), m_node_allocator(alloc), 
+          m_root(nullptr), m_size(0) 
+        { assign(first, last); };
     Tree(const Tree&);
+    Tree(Tree&&) noexcept;
+    ~Tree();
 
     Tree& operator=(const Tree&);
+    Tree& operator=(Tree&&) noexcept;
+
+    // Replaces the content with [first, last) in O(n) for sorted input,
+    // unsorted input is sorted (in parallel) and deduplicated first
+    template<class InputIt>
+    void assign(InputIt first, InputIt last);
     
     Result_Pair insert(T&& insert_value);
     Result_Pair insert(const T& insert_value);
+    // Constructs the element in its node. A single T argument is looked up 
+    // as is and moved in only if it is new, other arguments need the node 
+    // built first, it is dropped for a duplicate
+    template<class... Args>
+    Result_Pair emplace(Args&&... args);
+    // Looks key up (T, or any key with a transparent comparator) and only 
+    // if it is missing constructs T(key, args...) in a new node
+    template<class Key, class... Args>
+    Result_Pair try_emplace(Key&& key, Args&&... args);
+    // Inserts as close as possible to the position just before hint: 
+    // the search starts from the hint, so inserting next to it costs 
+    // O(log d) for distance d, and appending with end() or before_end() 
+    // as hint is amortized O(1). With Order_Statistics or an Aggregate 
+    // every ancestor's size or aggregate changes, so it is O(log n) there
+    iterator insert(const_iterator hint, T&& insert_value);
+    iterator insert(const_iterator hint, const T& insert_value);
+    template<class... Args>
+    iterator emplace_hint(const_iterator hint, Args&&... args);
+    // Inserts a batch: it is sorted and merged into the tree by one 
+    // recursive split/join descent, O(k log(n/k + 1)) for k new keys
+    template<class InputIt>
+    void insert(InputIt first, InputIt last);
 
     iterator erase(iterator position);
     std::size_t erase(const T& key);
-
-    const_iterator find(const T& value_to_find) const;
-
-    std::size_t size() const { return m_size; };
+    // Erases a batch of keys the same way, returns number of erased
+    template<class InputIt>
+    std::size_t erase_keys(InputIt first, InputIt last);
+    // Erase [first, last) or the keys in [lo, hi): the range is split off 
+    // as whole subtrees, freed in one pass, and the rest is joined back, 
+    // O(log n + k) for k erased
+    iterator erase(const_iterator first, const_iterator last);
+    std::size_t erase_range(const T& lo, const T& hi);
+
+    // Node handles, as in std::set: extracted nodes are relinked into 
+    // another tree without allocation or copying of the value. 
+    // Trees with unequal allocators can't share nodes, then the value 
+    // is moved into a new node instead
+    node_type extract(const_iterator position);
+    node_type extract(const T& key);
+    insert_return_type insert(node_type&& handle);
+    // moves in the nodes of source whose keys are missing here, 
+    // the rest stays in source
+    void merge(Tree& source);
+    void merge(Tree&& source) { merge(source); };
+
+    const_iterator find(const T& key) const { return m_find(key); };
+    bool contains(const T& key) const { return m_find(key) != end(); };
+    // Same as in std::set, one descent from the root each
+    // first element not less than key
+    const_iterator lower_bound(const T& key) const 
+        { return m_lower_bound(key); };
+    // first element greater than key
+    const_iterator upper_bound(const T& key) const 
+        { return m_upper_bound(key); };
+    std::pair<const_iterator, const_iterator> equal_range(const T& key) const;
+    std::size_t count(const T& key) const;
+
+    // Heterogeneous lookup with a transparent comparator (std::less<> etc.): 
+    // any key the comparator accepts, no temporary T is built
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    const_iterator find(const Key& key) const { return m_find(key); };
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    bool contains(const Key& key) const { return m_find(key) != end(); };
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    const_iterator lower_bound(const Key& key) const 
+        { return m_lower_bound(key); };
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    const_iterator upper_bound(const Key& key) const 
+        { return m_upper_bound(key); };
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    std::pair<const_iterator, const_iterator> equal_range(const Key& key) const
+        { return std::make_pair(m_lower_bound(key), m_upper_bound(key)); };
+    // several elements may be equivalent to such a key
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    std::size_t count(const Key& key) const;
+    template<class Key, class C = Compare, class = typename C::is_transparent>
+    std::size_t erase(const Key& key);
+
+    // Order statistics in O(log n), need Order_Statistics = true
+    // number of keys less than key
+    std::size_t rank(const T& key) const;
+    // k-th smallest key counting from 0, end() if k >= size()
+    const_iterator select(std::size_t k) const;
+    // number of keys in [lo, hi)
+    std::size_t count_range(const T& lo, const T& hi) const;
+
+    // Aggregate of the keys in [lo, hi) in O(log n), needs an 
+    // Aggregate policy
+    template<class Policy = Aggregate>
+    typename Policy::value_type aggregate(const T& lo, const T& hi) const;
+
+    // Splits the content in O(log n): first gets the keys less than key, 
+    // second the rest, this tree is left empty. Without Order_Statistics 
+    // counting the smaller part adds O(min(|first|, |second|))
+    std::pair<Tree, Tree> split(const T& key);
+    // Concatenates two trees in O(log n), every key of left must be 
+    // less than every key of right. Trees with unequal allocators can't 
+    // share nodes, right is then moved element by element
+    static Tree join(Tree&& left, Tree&& right);
+
+    // Set algebra by recursive split and join, O(m log(n/m + 1)) work 
+    // for sizes m <= n, independent subproblems run on separate threads. 
+    // union_with reuses the nodes of other, pass it with std::move 
+    // to avoid the copy
+    void union_with(Tree other);
+    void intersect_with(const Tree& other);
+    void difference_with(const Tree& other);
+
+    // O(1)
+    std::size_t size() const;
+
+    Compare key_comp() const { return this->comparator(); };
+
+    // Immutable copy for read-only use: one array in Eytzinger order, 
+    // searched without branches and with prefetching (see Frozen_Tree.h)
+    Frozen_Tree<T, Compare> freeze() const 
+        { return Frozen_Tree<T, Compare>(begin(), end(), this->comparator()); };
+    // Persistent copy: changes copy only the path from the root, copies 
+    // and snapshots are O(1) and share nodes (see Persistent_Tree.h)
+    Persistent_Tree<T, Compare, Alloc> persist() const 
+        { return Persistent_Tree<T, Compare, Alloc>(
+              begin(), end(), this->comparator(), Alloc(m_node_allocator)); };
 
     void print();
 
     // Different iterator getters
     iterator begin() const;
     const_iterator cbegin() const { return begin(); };
-    iterator end() const { return iterator(mc_end); };
-    const_iterator cend() const { return mc_end; };
+    iterator end() const { return iterator(nullptr, this); };
+    const_iterator cend() const { return end(); };
     reverse_iterator rbegin() const 
-        { return reverse_iterator(mc_end); };
+        { return reverse_iterator(end()); };
     const_reverse_iterator rcbegin() const 
-        { return const_reverse_iterator(mc_end); };
+        { return const_reverse_iterator(end()); };
     reverse_iterator rend() const 
         { return reverse_iterator(begin()); };
     const_reverse_iterator rcend() const 
@@ -55,65 +250,81 @@ class Tree {
     iterator before_end() const;
 
  private:
-    Alloc m_raw_allocator;
+    Node_Alloc m_node_allocator;
     
-    Node_Ptr m_root;
+    Node* m_root;
     std::size_t m_size;
 
-    // pass-the-end and befor-begin iterators
-    const iterator mc_end = iterator(this);
-    const iterator mc_before_begin = iterator(this);
+    // first and last nodes, they make begin(), before_end() and 
+    // hinted insertion at either end O(1)
+    Node* m_leftmost = nullptr;
+    Node* m_rightmost = nullptr;
 
-    struct Node {
-        Node_Ptr left;
-        Node_Ptr right;
-        Weak_Node_Ptr parent;
+    // subtree size, present only with Order_Statistics
+    struct Node_Size {
+        std::size_t size = 1;
+    };
+    struct No_Node_Size {};
+
+    // aggregate of the subtree, present only with an Aggregate policy
+    static constexpr bool mc_aggregated = 
+        !std::is_same<Aggregate, No_Aggregate>::value;
+    struct Node_Aggregate {
+        typename Aggregate::value_type aggregate;
+    };
+    struct No_Node_Aggregate {};
+
+    // Nodes are owned by the tree: left and right are owning links, 
+    // parent is a non-owning back link
+    struct Node : std::conditional_t<Order_Statistics, 
+                                     Node_Size, No_Node_Size>, 
+                  std::conditional_t<mc_aggregated, 
+                                     Node_Aggregate, No_Node_Aggregate> {
+        Node* left;
+        Node* right;
+        Node* parent;
 
         int8_t diff; // H(L) - H(R)
 
         T value;
 
-        Node(const Node_Ptr& parent, const T& value);
-        Node(const Node_Ptr& parent, T&& value);
+        Node(Node* parent, const T& value);
+        Node(Node* parent, T&& value);
+        template<class... Args>
+        Node(Node* parent, std::in_place_t, Args&&... args);
     };
 
-    class iterator : public std::iterator<std::bidirectional_iterator_tag, T> {
+    // Plain pair of raw pointers, trivially copyable. 
+    // Null self is both the past-the-end and the before-begin position: 
+    // ++ from it gives begin(), -- gives before_end().
+    class iterator {
      private:
-        Weak_Node_Ptr self;
+        Node* self;
         const Tree* owner;
 
      public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
         using reference = const T&;
 
-        iterator() = delete;
-        iterator(iterator&& init) : self(std::move(init.self)), 
-                                    owner(std::move(init.owner)) {};
-        iterator(const iterator& init) : self(init.self), 
-                                         owner(init.owner) {};
-        ~iterator() {};
-
-        iterator(const Node_Ptr& init, 
+        iterator() : self(nullptr), owner(nullptr) {};
+        iterator(Node* init, 
                  const Tree* owner) : self(init), owner(owner) {};
-        iterator(const Weak_Node_Ptr& init, 
-                 const Tree* owner) : self(init), owner(owner) {};
-        iterator(Weak_Node_Ptr&& init, 
-                 const Tree* owner) : self(init), owner(owner) {};
-        iterator(const Tree* owner) : owner(owner) {};
-
-        iterator& operator=(const iterator& to_copy); 
-        iterator& operator=(iterator&& to_move);
 
-        operator Node_Ptr() const { return self.lock(); };
-        operator Weak_Node_Ptr() const { return self; };
+        operator Node*() const { return self; };
 
         // for LegacyIterator
-        const T& operator*() const;
+        const T& operator*() const { return self->value; };
         iterator& operator++();    
 
         // for LegacyInputIterator
-        bool operator==(const iterator&) const; // EqualityComparable
-        bool operator!=(const iterator&) const;
-        const T* operator->() const;
+        bool operator==(const iterator& to_compare) const  // EqualityComparable
+            { return self == to_compare.self; };
+        bool operator!=(const iterator& to_compare) const
+            { return self != to_compare.self; };
+        const T* operator->() const { return &(self->value); };
         iterator operator++(int);
 
         // for BidirectionalIterator
@@ -121,32 +332,219 @@ class Tree {
         iterator operator--(int);
     };
 
-    template<class InsType>
-    Result_Pair m_insert(InsType&& i_value);
+    // Owner of an extracted node, frees it with the allocator of its tree
+    class Node_Handle {
+     public:
+        Node_Handle() : m_node(nullptr) {};
+        Node_Handle(Node_Handle&& other) noexcept
+            : m_node(other.m_node), m_allocator(std::move(other.m_allocator))
+            { other.m_node = nullptr; };
+        Node_Handle& operator=(Node_Handle&& other) noexcept;
+        ~Node_Handle() { m_reset(); };
+
+        bool empty() const { return !m_node; };
+        explicit operator bool() const { return m_node; };
+        // the value may be changed before the node is inserted again
+        T& value() const { return m_node->value; };
 
-    iterator m_erase(Node_Ptr node_to_erase);
+     private:
+        friend class Tree;
+
+        Node* m_node;
+        std::optional<Node_Alloc> m_allocator;
+
+        Node_Handle(Node* node, const Node_Alloc& allocator) 
+            : m_node(node), m_allocator(allocator) {};
+        void m_reset();
+    };
 
-    Node_Ptr m_copy_subtree(const Node_Ptr&, const Node_Ptr&, 
-                            Alloc& alloc);
+    struct Insert_Return {
+        iterator position;
+        bool inserted;
+        node_type node;
+    };
 
-    // Here const means that pointer remains on the same node, 
-    // tree structure changes!
+    template<class InsType>
+    Result_Pair m_insert(InsType&& i_value);
+    // inserts into the (sub)tree under top, which must be non-empty; 
+    // returns the new node or the one holding an equal value
+    template<class InsType>
+    Node* m_insert_below(Node* top, InsType&& i_value, bool& inserted);
+    // Same, but the place is searched for key and make(parent) is 
+    // called for the new node only when key is missing
+    template<class Key, class Make>
+    Result_Pair m_insert_with(const Key& key, Make&& make);
+    template<class Key, class Make>
+    Node* m_insert_below(Node* top, const Key& key, Make&& make, 
+                         bool& inserted);
+    template<class InsType>
+    iterator m_insert_hint(Node* hint, InsType&& i_value);
+    // Same, with make(parent) called as in m_insert_with
+    template<class Key, class Make>
+    Result_Pair m_insert_hint_with(Node* hint, const Key& key, Make&& make);
+    // recomputes m_leftmost and m_rightmost after bulk changes
+    void m_reset_bounds();
+
+    // takes ownership of a detached subtree of size elements
+    Tree(Node* root, std::size_t size, const Compare& compare, 
+         const Node_Alloc& alloc);
+    static std::size_t m_count(const Node*);
+    // Number of elements in left, of total in left and right together: 
+    // O(1) with subtree sizes, otherwise both are walked in order side 
+    // by side until one ends, O(min) steps
+    static std::size_t m_left_size(const Node* left, const Node* right, 
+                                   std::size_t total);
+    // in-order successor of node inside the subtree of root, or nullptr
+    static const Node* m_next_in(const Node* node, const Node* root);
+
+    // recompute subtree sizes and aggregates from the children, the path 
+    // version goes up to the (sub)tree root; both do nothing without 
+    // Order_Statistics and Aggregate
+    static void m_update(Node*);
+    static void m_update_path(Node*);
+    static std::size_t m_subtree_size(const Node*);
+    static auto m_subtree_aggregate(const Node*);
+
+    iterator m_erase(Node* node_to_erase);
+
+    // -1, 0 or 1 as a is less, equivalent or greater than b, 
+    // a single comparison for a three-way comparator
+    template<class A, class B>
+    int m_three_way(const A& a, const B& b) const 
+        { return three_way_compare(this->comparator(), a, b); };
+
+    // lookups for T and transparently compared keys
+    template<class Key>
+    const_iterator m_find(const Key& key) const;
+    template<class Key>
+    const_iterator m_lower_bound(const Key& key) const;
+    template<class Key>
+    const_iterator m_upper_bound(const Key& key) const;
+    // erases the keys in [*lo, *hi), null bound is no bound
+    std::size_t m_erase_range(const T* lo, const T* hi);
+    // takes the node out of its (sub)tree and rebalances, 
+    // returns some node left in that tree or nullptr if it got empty
+    Node* m_unlink(Node* node_to_unlink);
+
+    Node* m_copy_subtree(const Node*, Node*);
+
+    // bulk loading helpers for assign
+    template<class InputIt>
+    void m_assign(InputIt first, InputIt last, std::input_iterator_tag);
+    template<class ForwardIt>
+    void m_assign(ForwardIt first, ForwardIt last, 
+                  std::forward_iterator_tag);
+    void m_assign_unsorted(std::vector<T>& values);
+    // builds perfectly balanced subtree from the next count values of 
+    // strictly increasing sequence, height gets the subtree height
+    template<class InputIt>
+    Node* m_build(InputIt& it, std::size_t count, int& height);
+    void m_set_root(Node* root, std::size_t size);
+
+    template<class RandomIt>
+    static void m_parallel_sort(RandomIt first, RandomIt last, 
+                                const Compare& compare, unsigned depth);
+    static unsigned m_parallel_depth();
+    // sorts and deduplicates the values
+    void m_sort_unique(std::vector<T>& values) const;
+
+    // Join-based helpers. They work on detached subtrees (root parent is 
+    // null) whose heights are passed along, so nothing is recounted.
+    // Height of the result goes to the height argument.
+    static int m_height(const Node*);
+
+    // joins left < pivot < right 
+    Node* m_join(Node* left, int left_h, Node* pivot, 
+                 Node* right, int right_h, int& height);
+    // joins left < right
+    Node* m_join(Node* left, int left_h, Node* right, int right_h, 
+                 int& height);
+    // splits subtree into keys less and greater than key, 
+    // returns the detached node equal to key or nullptr
+    Node* m_split(Node* node, int node_h, const T& key, 
+                  Node*& left, int& left_h, Node*& right, int& right_h);
+    // detaches the maximum node, rest gets the remaining subtree
+    Node* m_split_last(Node* node, int node_h, Node*& rest, int& rest_h);
+    // cuts node off its children, which become detached subtrees
+    static void m_detach_children(Node* node, int node_h, 
+                                  Node*& left, int& left_h, 
+                                  Node*& right, int& right_h);
+
+    // few keys against a big subtree are cheaper to apply one by one
+    // (the subtree holds about 2^(node_h - 1) keys, sparse is 64 times less)
+    static bool m_sparse_batch(std::ptrdiff_t count, int node_h) 
+        { return count == 1 || (node_h > 7 && 
+              count < (std::ptrdiff_t(1) << (std::min(node_h, 60) - 7))); };
+
+    // merges sorted unique range into subtree, creating nodes for new keys
+    template<class MoveIt>
+    Node* m_union(Node* node, int node_h, MoveIt first, MoveIt last, 
+                  int& height, std::size_t& added);
+    // removes keys of sorted unique range from subtree
+    template<class RandomIt>
+    Node* m_difference(Node* node, int node_h, 
+                       RandomIt first, RandomIt last, 
+                       int& height, std::size_t& removed);
+    // subranges shorter than this are sorted in one thread
+    static constexpr std::ptrdiff_t mc_parallel_cutoff = 1 << 16;
+
+    // Tree against tree operations, dropped counts destroyed nodes. 
+    // Only union takes nodes of other, the rest just read it.
+    Node* m_union_with(Node* node, int node_h, Node* other, int other_h, 
+                       int& height, std::size_t& dropped, unsigned depth);
+    Node* m_intersect_with(Node* node, int node_h, 
+                           const Node* other, int other_h, 
+                           int& height, std::size_t& dropped, 
+                           unsigned depth);
+    Node* m_difference_with(Node* node, int node_h, 
+                            const Node* other, int other_h, 
+                            int& height, std::size_t& dropped, 
+                            unsigned depth);
+    // Forking needs an allocator safe to call from several threads, 
+    // the stateless std::allocator is (Pool_Allocator is not). 
+    // Subtrees lower than mc_fork_height (under ~64K nodes) aren't 
+    // worth a thread.
+    static constexpr bool mc_thread_safe_nodes = 
+        std::is_same<Alloc, std::allocator<T>>::value;
+    static constexpr int mc_fork_height = 16;
+    static bool m_fork(unsigned depth, int node_h) 
+        { return mc_thread_safe_nodes && depth > 0 && 
+                 node_h >= mc_fork_height; };
+
+    // node allocation through the rebound allocator
+    template<class... Args>
+    Node* m_create_node(Args&&... args);
+    void m_destroy_node(Node*);
+    // returns the number of destroyed nodes
+    std::size_t m_destroy_subtree(Node*);
 
     // emplaces subtree with top node instead of right or left parent's subtree
-    void m_emplace_right(const Node_Ptr& node, const Node_Ptr& parent);
-    void m_emplace_left(const Node_Ptr& node, const Node_Ptr& parent);
+    void m_emplace_right(Node* node, Node* parent);
+    void m_emplace_left(Node* node, Node* parent);
+
+    // puts new_node (may be null) in place of old_node under old_node's parent
+    void m_replace(Node* old_node, Node* new_node);
+
+    // exchanges node with its in-order successor by relinking, 
+    // so that node ends up with no left child
+    void m_swap_with_successor(Node* node);
 
     // performing rotations with top node given
     // returns the top node of the resul subtree
-    Node_Ptr m_rotate_right(const Node_Ptr&);
-    Node_Ptr m_rotate_left(const Node_Ptr&);
-    Node_Ptr m_big_rotate_right(const Node_Ptr&);
-    Node_Ptr m_big_rotate_left(const Node_Ptr&);
+    Node* m_rotate_right(Node*);
+    Node* m_rotate_left(Node*);
+    Node* m_big_rotate_right(Node*);
+    Node* m_big_rotate_left(Node*);
+
+    // retraces up from the node whose subtree just grew by one level, 
+    // returns the last node reached; grew is true if that node is the 
+    // root and its height grew as well
+    Node* m_grow_retrace(Node* grown, bool& grew);
 
     // performing balancing dependent on node b from which we reach top node a to perform rotation with
     // returns the top node of the result subtree
-    Node_Ptr m_left_balance(const Node_Ptr&); // when left a-subtree's height less (a.diff -> -2)
-    Node_Ptr m_right_balance(const Node_Ptr&); // when right a-subtree's height less (a.diff -> 2) 
+    Node* m_left_balance(Node*); // when left a-subtree's height less (a.diff -> -2)
+    Node* m_right_balance(Node*); // when right a-subtree's height less (a.diff -> 2) 
 };
         
 
@@ -154,43 +552,1163 @@ class Tree {
 //Tree<T>::Node::Tree_Node();
 //Method realization
 
-template<class T, class Compare, class Alloc>
-Tree<T, Compare, Alloc>::Tree(const Tree& copy) : m_size(copy.m_size) {
-    m_root = m_copy_subtree(copy.m_root, Node_Ptr(), m_raw_allocator);
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Tree(const Tree& copy) 
+    : Compare_Base(copy), 
+      m_node_allocator(Node_Alloc_Traits::
+          select_on_container_copy_construction(copy.m_node_allocator)),
+      m_root(nullptr), m_size(copy.size()) {
+    if(copy.m_root) {
+        m_root = m_copy_subtree(copy.m_root, nullptr);
+    };
+    m_reset_bounds();
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Tree(
+    Tree&& other) noexcept
+    : Compare_Base(other), 
+      m_node_allocator(std::move(other.m_node_allocator)),
+      m_root(other.m_root), m_size(other.m_size), 
+      m_leftmost(other.m_leftmost), m_rightmost(other.m_rightmost) {
+    other.m_root = nullptr;
+    other.m_size = 0;
+    other.m_leftmost = nullptr;
+    other.m_rightmost = nullptr;
 };
 
-template<class T, class Compare, class Alloc>
-Tree<T, Compare, Alloc>&
-Tree<T, Compare, Alloc>::operator=(const Tree& copy) {
-    if(m_root != copy.m_root) {
-        m_size = copy.m_size;
-        m_root = m_copy_subtree(copy.m_root, Node_Ptr(), 
-                                m_raw_allocator);
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::~Tree() {
+    m_destroy_subtree(m_root);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>&
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::operator=(
+    const Tree& copy) {
+    if(this != &copy) {
+        // copied first, so a throwing copy leaves this tree as it was
+        Node* root = copy.m_root ? m_copy_subtree(copy.m_root, nullptr) 
+                                 : nullptr;
+        Compare_Base::operator=(copy);
+        m_set_root(root, copy.m_size);
     };
     return *this;
 };
 
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::Node_Ptr 
-Tree<T, Compare, Alloc>::m_copy_subtree(const Node_Ptr& to_copy, 
-                                        const Node_Ptr& parent,
-                                        Alloc& alloc) {
-    Node_Ptr ret = std::allocate_shared<Node>(alloc, *to_copy);
-    ret->parent = parent;
-    if(to_copy->left) {
-        ret->left = m_copy_subtree(to_copy->left, ret, alloc);
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>&
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::operator=(
+    Tree&& other) noexcept {
+    if(this != &other) {
+        m_destroy_subtree(m_root);
+        Compare_Base::operator=(other);
+        m_node_allocator = std::move(other.m_node_allocator);
+        m_root = other.m_root;
+        m_size = other.m_size;
+        m_leftmost = other.m_leftmost;
+        m_rightmost = other.m_rightmost;
+        other.m_root = nullptr;
+        other.m_size = 0;
+        other.m_leftmost = nullptr;
+        other.m_rightmost = nullptr;
+    };
+    return *this;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class InputIt>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::assign(InputIt first, 
+                                                             InputIt last) {
+    m_assign(first, last, 
+             typename std::iterator_traits<InputIt>::iterator_category());
+};
+
+// single pass ranges can't be checked for order in place
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class InputIt>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_assign(
+    InputIt first, InputIt last, std::input_iterator_tag) {
+    std::vector<T> values(first, last);
+    m_assign_unsorted(values);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class ForwardIt>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_assign(
+    ForwardIt first, ForwardIt last, std::forward_iterator_tag) {
+    const Compare& compare = this->comparator();
+    bool strictly_sorted = 
+        std::adjacent_find(first, last, [&compare](const T& a, const T& b) {
+            return !compare(a, b);
+        }) == last;
+    if(strictly_sorted) {
+        std::size_t count = std::distance(first, last);
+        int height;
+        m_set_root(m_build(first, count, height), count);
+    } else {
+        std::vector<T> values(first, last);
+        m_assign_unsorted(values);
+    };
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_assign_unsorted(
+               std::vector<T>& values) {
+    m_sort_unique(values);
+    auto it = std::make_move_iterator(values.begin());
+    int height;
+    m_set_root(m_build(it, values.size(), height), values.size());
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class InputIt>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_build(InputIt& it, 
+                                                              std::size_t count,
+                                                              int& height) {
+    if(count == 0) {
+        height = 0;
+        return nullptr;
+    };
+    int left_height;
+    int right_height;
+    Node* left = m_build(it, count / 2, left_height);
+    Node* node;
+    try {
+        node = m_create_node(nullptr, *it);
+    } catch(...) {
+        m_destroy_subtree(left);
+        throw;
+    };
+    ++it;
+    m_emplace_left(left, node);
+    try {
+        m_emplace_right(m_build(it, count - count / 2 - 1, right_height), 
+                        node);
+    } catch(...) {
+        m_destroy_subtree(node);
+        throw;
+    };
+    node->diff = left_height - right_height;
+    m_update(node);
+    height = std::max(left_height, right_height) + 1;
+    return node;
+};
+
+// old nodes are dropped only after the new ones are built
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_set_root(
+    Node* root, std::size_t size) {
+    m_destroy_subtree(m_root);
+    m_root = root;
+    m_size = size;
+    m_reset_bounds();
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_reset_bounds() {
+    m_leftmost = m_root;
+    m_rightmost = m_root;
+    if(m_root) {
+        while(m_leftmost->left) {
+            m_leftmost = m_leftmost->left;
+        };
+        while(m_rightmost->right) {
+            m_rightmost = m_rightmost->right;
+        };
+    };
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_sort_unique(
+               std::vector<T>& values) const {
+    const Compare& compare = this->comparator();
+    if(!std::is_sorted(values.begin(), values.end(), compare)) {
+        m_parallel_sort(values.begin(), values.end(), compare, 
+                        m_parallel_depth());
+    };
+    // in a sorted range equal neighbours are the not less ones
+    values.erase(std::unique(values.begin(), values.end(), 
+                             [&compare](const T& a, const T& b) {
+                                 return !compare(a, b);
+                             }), 
+                 values.end());
+};
+
+// number of halvings that gives about one piece of work per core
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+unsigned 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_parallel_depth() {
+    unsigned depth = 0;
+    for(unsigned threads = std::thread::hardware_concurrency(); 
+        threads > 1; threads /= 2) {
+        ++depth;
+    };
+    return depth;
+};
+
+// splits the range in halves sorted by separate threads, depth halvings
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class RandomIt>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_parallel_sort(
+    RandomIt first, RandomIt last, const Compare& compare, unsigned depth) {
+    if(depth == 0 || last - first < mc_parallel_cutoff) {
+        std::sort(first, last, compare);
+        return;
+    };
+    RandomIt middle = first + (last - first) / 2;
+    std::future<void> left_half = std::async(std::launch::async, [=]() {
+        m_parallel_sort(first, middle, compare, depth - 1);
+    });
+    m_parallel_sort(middle, last, compare, depth - 1);
+    left_half.get();
+    std::inplace_merge(first, middle, last, compare);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class InputIt>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::insert(InputIt first, 
+                                                             InputIt last) {
+    std::vector<T> values(first, last);
+    m_sort_unique(values);
+    Node* root = m_root;
+    m_root = nullptr;
+    int height;
+    std::size_t added = 0;
+    root = m_union(root, m_height(root), 
+                   std::make_move_iterator(values.begin()), 
+                   std::make_move_iterator(values.end()), height, added);
+    m_root = root;
+    m_size += added;
+    m_reset_bounds();
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class InputIt>
+std::size_t 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::erase_keys(InputIt first, 
+                                                                 InputIt last) {
+    std::vector<T> keys(first, last);
+    m_sort_unique(keys);
+    Node* root = m_root;
+    m_root = nullptr;
+    int height;
+    std::size_t removed = 0;
+    root = m_difference(root, m_height(root), keys.begin(), keys.end(), 
+                        height, removed);
+    m_root = root;
+    m_size -= removed;
+    m_reset_bounds();
+    return removed;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Tree(
+    Node* root, std::size_t size, const Compare& compare, 
+    const Node_Alloc& alloc)
+    : Compare_Base(compare), m_node_allocator(alloc), m_root(root), 
+      m_size(size) {
+    m_reset_bounds();
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+std::pair<Tree<T, Compare, Alloc, Order_Statistics, Aggregate>, 
+          Tree<T, Compare, Alloc, Order_Statistics, Aggregate>> 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::split(const T& key) {
+    Node* root = m_root;
+    m_root = nullptr;
+    Node* left;
+    Node* right;
+    int left_h;
+    int right_h;
+    Node* equal = m_split(root, m_height(root), key, 
+                          left, left_h, right, right_h);
+    if(equal) {
+        right = m_join(nullptr, 0, equal, right, right_h, right_h);
+    };
+    std::size_t left_size = m_left_size(left, right, m_size);
+    std::pair<Tree, Tree> ret(
+        Tree(left, left_size, this->comparator(), m_node_allocator), 
+        Tree(right, m_size - left_size, this->comparator(), 
+             m_node_allocator));
+    m_size = 0;
+    m_leftmost = nullptr;
+    m_rightmost = nullptr;
+    return ret;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate> 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::join(Tree&& left, 
+                                                           Tree&& right) {
+    Tree ret(std::move(left));
+    if(!right.m_root) {
+        return ret;
+    };
+    if(ret.m_node_allocator != right.m_node_allocator) {
+        for(const T& value : right) {
+            ret.m_insert_hint(nullptr, value);
+        };
+        right.m_set_root(nullptr, 0);
+        return ret;
+    };
+    if(!ret.m_root) {
+        ret = std::move(right);
+        return ret;
+    };
+    Node* root = ret.m_root;
+    ret.m_root = nullptr;
+    int height;
+    ret.m_root = ret.m_join(root, m_height(root), 
+                            right.m_root, m_height(right.m_root), height);
+    ret.m_rightmost = right.m_rightmost;
+    ret.m_size += right.m_size;
+    right.m_root = nullptr;
+    right.m_size = 0;
+    right.m_leftmost = nullptr;
+    right.m_rightmost = nullptr;
+    return ret;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::union_with(Tree other) {
+    if(m_node_allocator != other.m_node_allocator) {
+        Tree own(nullptr, 0, this->comparator(), m_node_allocator);
+        own.assign(other.begin(), other.end());
+        other = std::move(own);
+    };
+    Node* root = m_root;
+    Node* other_root = other.m_root;
+    m_root = nullptr;
+    other.m_root = nullptr;
+    int height;
+    std::size_t dropped = 0;
+    root = m_union_with(root, m_height(root), 
+                        other_root, m_height(other_root), 
+                        height, dropped, m_parallel_depth());
+    m_root = root;
+    m_size = m_size + other.m_size - dropped;
+    m_reset_bounds();
+    other.m_size = 0;
+    other.m_leftmost = nullptr;
+    other.m_rightmost = nullptr;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::intersect_with(
+    const Tree& other) {
+    if(&other == this) {
+        return;
+    };
+    Node* root = m_root;
+    m_root = nullptr;
+    int height;
+    std::size_t dropped = 0;
+    root = m_intersect_with(root, m_height(root), 
+                            other.m_root, m_height(other.m_root), 
+                            height, dropped, m_parallel_depth());
+    m_root = root;
+    m_size -= dropped;
+    m_reset_bounds();
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::difference_with(
+    const Tree& other) {
+    if(&other == this) {
+        m_set_root(nullptr, 0);
+        return;
+    };
+    Node* root = m_root;
+    m_root = nullptr;
+    int height;
+    std::size_t dropped = 0;
+    root = m_difference_with(root, m_height(root), 
+                             other.m_root, m_height(other.m_root), 
+                             height, dropped, m_parallel_depth());
+    m_root = root;
+    m_size -= dropped;
+    m_reset_bounds();
+};
+
+// other is split by the root key of node, the halves are united 
+// recursively and joined back around the root. 
+// The left halves go to another thread when forking pays off.
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_union_with(
+    Node* node, int node_h, Node* other, int other_h, int& height, 
+    std::size_t& dropped, unsigned depth) {
+    if(!node) {
+        height = other_h;
+        return other;
+    };
+    if(!other) {
+        height = node_h;
+        return node;
+    };
+    Node* left;
+    Node* right;
+    int left_h;
+    int right_h;
+    m_detach_children(node, node_h, left, left_h, right, right_h);
+    Node* other_left;
+    Node* other_right;
+    int other_left_h;
+    int other_right_h;
+    Node* equal = m_split(other, other_h, node->value, 
+                          other_left, other_left_h, 
+                          other_right, other_right_h);
+    if(equal) {
+        m_destroy_node(equal);
+        ++dropped;
+    };
+
+    bool fork = m_fork(depth, node_h);
+    unsigned sub_depth = fork ? depth - 1 : depth;
+    auto left_part = [&]() {
+        left = m_union_with(left, left_h, other_left, other_left_h, 
+                            left_h, dropped, sub_depth);
+    };
+    std::future<void> left_half;
+    if(fork) {
+        left_half = std::async(std::launch::async, left_part);
+    } else {
+        left_part();
+    };
+    std::size_t right_dropped = 0;
+    right = m_union_with(right, right_h, other_right, other_right_h, 
+                         right_h, right_dropped, sub_depth);
+    if(fork) {
+        left_half.get();
+    };
+    dropped += right_dropped;
+    return m_join(left, left_h, node, right, right_h, height);
+};
+
+// node is split by the root key of other, which is only read
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_intersect_with(
+    Node* node, int node_h, const Node* other, int other_h, int& height, 
+    std::size_t& dropped, unsigned depth) {
+    if(!node || !other) {
+        dropped += m_destroy_subtree(node);
+        height = 0;
+        return nullptr;
+    };
+    Node* left;
+    Node* right;
+    int left_h;
+    int right_h;
+    Node* equal = m_split(node, node_h, other->value, 
+                          left, left_h, right, right_h);
+    int other_left_h = (other->diff >= 0) ? other_h - 1 : other_h - 2;
+    int other_right_h = (other->diff <= 0) ? other_h - 1 : other_h - 2;
+
+    bool fork = m_fork(depth, node_h);
+    unsigned sub_depth = fork ? depth - 1 : depth;
+    auto left_part = [&]() {
+        left = m_intersect_with(left, left_h, other->left, other_left_h, 
+                                left_h, dropped, sub_depth);
+    };
+    std::future<void> left_half;
+    if(fork) {
+        left_half = std::async(std::launch::async, left_part);
+    } else {
+        left_part();
+    };
+    std::size_t right_dropped = 0;
+    right = m_intersect_with(right, right_h, other->right, other_right_h, 
+                             right_h, right_dropped, sub_depth);
+    if(fork) {
+        left_half.get();
+    };
+    dropped += right_dropped;
+    if(equal) {
+        return m_join(left, left_h, equal, right, right_h, height);
+    };
+    return m_join(left, left_h, right, right_h, height);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_difference_with(
+    Node* node, int node_h, const Node* other, int other_h, int& height, 
+    std::size_t& dropped, unsigned depth) {
+    if(!node || !other) {
+        height = node_h;
+        return node;
+    };
+    Node* left;
+    Node* right;
+    int left_h;
+    int right_h;
+    Node* equal = m_split(node, node_h, other->value, 
+                          left, left_h, right, right_h);
+    if(equal) {
+        m_destroy_node(equal);
+        ++dropped;
+    };
+    int other_left_h = (other->diff >= 0) ? other_h - 1 : other_h - 2;
+    int other_right_h = (other->diff <= 0) ? other_h - 1 : other_h - 2;
+
+    bool fork = m_fork(depth, node_h);
+    unsigned sub_depth = fork ? depth - 1 : depth;
+    auto left_part = [&]() {
+        left = m_difference_with(left, left_h, other->left, other_left_h, 
+                                 left_h, dropped, sub_depth);
+    };
+    std::future<void> left_half;
+    if(fork) {
+        left_half = std::async(std::launch::async, left_part);
+    } else {
+        left_part();
+    };
+    std::size_t right_dropped = 0;
+    right = m_difference_with(right, right_h, other->right, other_right_h, 
+                              right_h, right_dropped, sub_depth);
+    if(fork) {
+        left_half.get();
+    };
+    dropped += right_dropped;
+    return m_join(left, left_h, right, right_h, height);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+std::size_t Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::size() const {
+    return m_size;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+std::size_t 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_count(
+    const Node* node) {
+    if constexpr(Order_Statistics) {
+        return m_subtree_size(node);
+    };
+    std::size_t count = 0;
+    while(node) {
+        count += 1 + m_count(node->right);
+        node = node->left;
+    };
+    return count;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+std::size_t 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_left_size(
+    const Node* left, const Node* right, std::size_t total) {
+    if constexpr(Order_Statistics) {
+        return m_subtree_size(left);
+    };
+    const Node* left_node = left;
+    const Node* right_node = right;
+    while(left_node && left_node->left) {
+        left_node = left_node->left;
+    };
+    while(right_node && right_node->left) {
+        right_node = right_node->left;
+    };
+    std::size_t steps = 0;
+    while(left_node && right_node) {
+        left_node = m_next_in(left_node, left);
+        right_node = m_next_in(right_node, right);
+        ++steps;
+    };
+    // the part that ended first has exactly steps elements
+    return left_node ? total - steps : steps;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+auto 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_next_in(
+    const Node* node, const Node* root) -> const Node* {
+    if(node->right) {
+        node = node->right;
+        while(node->left) {
+            node = node->left;
+        };
+        return node;
+    };
+    while(node != root && node->parent->left != node) {
+        node = node->parent;
+    };
+    return (node == root) ? nullptr : node->parent;
+};
+
+// the taller child is followed down, so the cost is O(log n)
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+int 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_height(
+    const Node* node) {
+    int height = 0;
+    while(node) {
+        ++height;
+        node = (node->diff < 0) ? node->right : node->left;
+    };
+    return height;
+};
+
+// pivot is hung on the spine of the taller tree where heights meet, 
+// then the path is retraced as after an insertion: O(|left_h - right_h|)
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_join(Node* left, 
+                                                             int left_h, 
+                                                             Node* pivot, 
+                                                             Node* right, 
+                                                             int right_h, 
+                                                             int& height) {
+    pivot->parent = nullptr;
+    if(left_h > right_h + 1) {
+        Node* temp = left;
+        Node* temp_parent = nullptr;
+        int temp_h = left_h;
+        while(temp_h > right_h + 1) {
+            temp_h -= (temp->diff <= 0) ? 1 : 2;
+            temp_parent = temp;
+            temp = temp->right;
+        };
+        m_emplace_left(temp, pivot);
+        m_emplace_right(right, pivot);
+        pivot->diff = temp_h - right_h;
+        m_update(pivot);
+        m_emplace_right(pivot, temp_parent);
+
+        bool grew;
+        Node* top = m_grow_retrace(pivot, grew);
+        m_update_path(pivot);
+        if(top->parent) {
+            height = left_h;
+            return left;
+        };
+        height = grew ? left_h + 1 : left_h;
+        return top;
+    } else if(right_h > left_h + 1) {
+        Node* temp = right;
+        Node* temp_parent = nullptr;
+        int temp_h = right_h;
+        while(temp_h > left_h + 1) {
+            temp_h -= (temp->diff >= 0) ? 1 : 2;
+            temp_parent = temp;
+            temp = temp->left;
+        };
+        m_emplace_right(temp, pivot);
+        m_emplace_left(left, pivot);
+        pivot->diff = left_h - temp_h;
+        m_update(pivot);
+        m_emplace_left(pivot, temp_parent);
+
+        bool grew;
+        Node* top = m_grow_retrace(pivot, grew);
+        m_update_path(pivot);
+        if(top->parent) {
+            height = right_h;
+            return right;
+        };
+        height = grew ? right_h + 1 : right_h;
+        return top;
+    } else {
+        m_emplace_left(left, pivot);
+        m_emplace_right(right, pivot);
+        pivot->diff = left_h - right_h;
+        m_update(pivot);
+        height = std::max(left_h, right_h) + 1;
+        return pivot;
+    };
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_join(Node* left, 
+                                                             int left_h, 
+                                                             Node* right, 
+                                                             int right_h, 
+                                                             int& height) {
+    if(!left) {
+        height = right_h;
+        return right;
+    };
+    if(!right) {
+        height = left_h;
+        return left;
+    };
+    Node* rest;
+    int rest_h;
+    Node* last = m_split_last(left, left_h, rest, rest_h);
+    return m_join(rest, rest_h, last, right, right_h, height);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_split(Node* node, 
+                                                              int node_h, 
+                                                              const T& key, 
+                                                              Node*& left, 
+                                                              int& left_h, 
+                                                              Node*& right, 
+                                                              int& right_h) {
+    if(!node) {
+        left = nullptr;
+        right = nullptr;
+        left_h = 0;
+        right_h = 0;
+        return nullptr;
+    };
+    Node* node_left;
+    Node* node_right;
+    int node_left_h;
+    int node_right_h;
+    m_detach_children(node, node_h, node_left, node_left_h, 
+                      node_right, node_right_h);
+
+    int order = m_three_way(key, node->value);
+    if(order < 0) {
+        Node* inner_right;
+        int inner_right_h;
+        Node* equal = m_split(node_left, node_left_h, key, left, left_h, 
+                              inner_right, inner_right_h);
+        right = m_join(inner_right, inner_right_h, node, 
+                       node_right, node_right_h, right_h);
+        return equal;
+    } else if(order > 0) {
+        Node* inner_left;
+        int inner_left_h;
+        Node* equal = m_split(node_right, node_right_h, key, 
+                              inner_left, inner_left_h, right, right_h);
+        left = m_join(node_left, node_left_h, node, 
+                      inner_left, inner_left_h, left_h);
+        return equal;
+    } else {
+        left = node_left;
+        left_h = node_left_h;
+        right = node_right;
+        right_h = node_right_h;
+        return node;
+    };
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_split_last(
+    Node* node, int node_h, Node*& rest, int& rest_h) {
+    Node* node_left;
+    Node* node_right;
+    int node_left_h;
+    int node_right_h;
+    m_detach_children(node, node_h, node_left, node_left_h, 
+                      node_right, node_right_h);
+    if(!node_right) {
+        rest = node_left;
+        rest_h = node_left_h;
+        return node;
+    };
+
+    Node* inner_rest;
+    int inner_rest_h;
+    Node* last = m_split_last(node_right, node_right_h, 
+                              inner_rest, inner_rest_h);
+    rest = m_join(node_left, node_left_h, node, 
+                  inner_rest, inner_rest_h, rest_h);
+    return last;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_detach_children(
+    Node* node, int node_h, Node*& left, int& left_h, Node*& right, 
+    int& right_h) {
+    left = node->left;
+    right = node->right;
+    left_h = (node->diff >= 0) ? node_h - 1 : node_h - 2;
+    right_h = (node->diff <= 0) ? node_h - 1 : node_h - 2;
+    if(left) {
+        left->parent = nullptr;
+    };
+    if(right) {
+        right->parent = nullptr;
+    };
+    node->left = nullptr;
+    node->right = nullptr;
+    node->diff = 0;
+};
+
+// the middle of the range splits the subtree, halves are merged 
+// recursively and joined back around the middle node
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class MoveIt>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_union(
+    Node* node, int node_h, MoveIt first, MoveIt last, int& height, 
+    std::size_t& added) {
+    if(first == last) {
+        height = node_h;
+        return node;
+    };
+    if(!node) {
+        std::size_t count = last - first;
+        added += count;
+        return m_build(first, count, height);
+    };
+    if(m_sparse_batch(last - first, node_h)) {
+        Node* top = node;
+        for(; first != last; ++first) {
+            bool inserted;
+            m_insert_below(top, *first, inserted);
+            if(inserted) {
+                ++added;
+            };
+            // a rotation at the top moves it exactly one level down
+            while(top->parent) {
+                top = top->parent;
+            };
+        };
+        height = m_height(top);
+        return top;
+    };
+    MoveIt middle = first + (last - first) / 2;
+    Node* left;
+    Node* right;
+    int left_h;
+    int right_h;
+    Node* pivot = m_split(node, node_h, *middle.base(), 
+                          left, left_h, right, right_h);
+    if(!pivot) {
+        pivot = m_create_node(nullptr, *middle);
+        ++added;
+    };
+    left = m_union(left, left_h, first, middle, left_h, added);
+    right = m_union(right, right_h, middle + 1, last, right_h, added);
+    return m_join(left, left_h, pivot, right, right_h, height);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class RandomIt>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_difference(
+    Node* node, int node_h, RandomIt first, RandomIt last, int& height, 
+    std::size_t& removed) {
+    if(first == last || !node) {
+        height = node_h;
+        return node;
+    };
+    if(m_sparse_batch(last - first, node_h)) {
+        Node* top = node;
+        for(; first != last && top; ++first) {
+            Node* temp = top;
+            int order;
+            while(temp && (order = m_three_way(*first, temp->value)) != 0) {
+                temp = (order < 0) ? temp->left : temp->right;
+            };
+            if(!temp) {
+                continue;
+            };
+            Node* survivor = m_unlink(temp);
+            m_destroy_node(temp);
+            ++removed;
+            if(temp == top) {
+                top = survivor;
+            };
+            // a rotation at the top moves it exactly one level down
+            while(top && top->parent) {
+                top = top->parent;
+            };
+        };
+        height = m_height(top);
+        return top;
+    };
+    RandomIt middle = first + (last - first) / 2;
+    Node* left;
+    Node* right;
+    int left_h;
+    int right_h;
+    Node* pivot = m_split(node, node_h, *middle, 
+                          left, left_h, right, right_h);
+    if(pivot) {
+        m_destroy_node(pivot);
+        ++removed;
+    };
+    left = m_difference(left, left_h, first, middle, left_h, removed);
+    right = m_difference(right, right_h, middle + 1, last, right_h, removed);
+    return m_join(left, left_h, right, right_h, height);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_update(Node* node) {
+    if constexpr(Order_Statistics) {
+        node->size = 1 + m_subtree_size(node->left) + 
+                     m_subtree_size(node->right);
+    };
+    if constexpr(mc_aggregated) {
+        node->aggregate = 
+            Aggregate::combine(Aggregate::combine(
+                                   m_subtree_aggregate(node->left), 
+                                   Aggregate::project(node->value)), 
+                               m_subtree_aggregate(node->right));
+    };
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_update_path(
+    Node* node) {
+    if constexpr(Order_Statistics || mc_aggregated) {
+        for(; node; node = node->parent) {
+            m_update(node);
+        };
+    };
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+std::size_t 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_subtree_size(
+    const Node* node) {
+    if constexpr(Order_Statistics) {
+        return node ? node->size : 0;
+    } else {
+        return m_count(node);
+    };
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+auto 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_subtree_aggregate(
+    const Node* node) {
+    if constexpr(mc_aggregated) {
+        return node ? node->aggregate : Aggregate::identity();
+    };
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+std::size_t 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::rank(const T& key) const {
+    static_assert(Order_Statistics, "rank() needs Order_Statistics");
+    const Compare& compare = this->comparator();
+    std::size_t count = 0;
+    Node* temp = m_root;
+    while(temp) {
+        if(compare(temp->value, key)) {
+            count += m_subtree_size(temp->left) + 1;
+            temp = temp->right;
+        } else {
+            temp = temp->left;
+        };
+    };
+    return count;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::const_iterator 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::select(
+    std::size_t k) const {
+    static_assert(Order_Statistics, "select() needs Order_Statistics");
+    Node* temp = m_root;
+    while(temp) {
+        std::size_t left_size = m_subtree_size(temp->left);
+        if(k < left_size) {
+            temp = temp->left;
+        } else if(k > left_size) {
+            k -= left_size + 1;
+            temp = temp->right;
+        } else {
+            break;
+        };
+    };
+    return iterator(temp, this);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+std::size_t 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::count_range(
+    const T& lo, const T& hi) const {
+    static_assert(Order_Statistics, "count_range() needs Order_Statistics");
+    const Compare& compare = this->comparator();
+    if(!compare(lo, hi)) {
+        return 0;
+    };
+    return rank(hi) - rank(lo);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class Policy>
+typename Policy::value_type 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::aggregate(const T& lo, 
+                                                          const T& hi) const {
+    static_assert(mc_aggregated && std::is_same<Policy, Aggregate>::value, 
+                  "aggregate() needs the Aggregate policy of the tree");
+    const Compare& compare = this->comparator();
+    // the top node inside [lo, hi), paths to both ends part there
+    Node* fork = m_root;
+    while(fork && (compare(fork->value, lo) || !compare(fork->value, hi))) {
+        fork = compare(fork->value, lo) ? fork->right : fork->left;
+    };
+    if(!fork) {
+        return Aggregate::identity();
+    };
+
+    // keys not less than lo in the left subtree, taken right to left
+    typename Aggregate::value_type left_part = Aggregate::identity();
+    for(Node* temp = fork->left; temp; ) {
+        if(compare(temp->value, lo)) {
+            temp = temp->right;
+        } else {
+            left_part = Aggregate::combine(
+                Aggregate::project(temp->value), 
+                Aggregate::combine(m_subtree_aggregate(temp->right), 
+                                   left_part));
+            temp = temp->left;
+        };
+    };
+    // keys less than hi in the right subtree, taken left to right
+    typename Aggregate::value_type right_part = Aggregate::identity();
+    for(Node* temp = fork->right; temp; ) {
+        if(compare(temp->value, hi)) {
+            right_part = Aggregate::combine(
+                right_part, 
+                Aggregate::combine(m_subtree_aggregate(temp->left), 
+                                   Aggregate::project(temp->value)));
+            temp = temp->right;
+        } else {
+            temp = temp->left;
+        };
     };
-    if(to_copy->right) {
-        ret->right = m_copy_subtree(to_copy->right, ret, alloc);
+    return Aggregate::combine(Aggregate::combine(
+                                  left_part, 
+                                  Aggregate::project(fork->value)), 
+                              right_part);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_copy_subtree(
+    const Node* to_copy, Node* parent) {
+    Node* ret = m_create_node(parent, to_copy->value);
+    ret->diff = to_copy->diff;
+    try {
+        if(to_copy->left) {
+            ret->left = m_copy_subtree(to_copy->left, ret);
+        };
+        if(to_copy->right) {
+            ret->right = m_copy_subtree(to_copy->right, ret);
+        };
+    } catch(...) {
+        // the part copied so far
+        m_destroy_subtree(ret);
+        throw;
     };
+    m_update(ret);
     return ret;
 };
 
-template<class T, class Compare, class Alloc>
-void Tree<T, Compare, Alloc>::print() {
-    std::deque<Node_Ptr> queue;
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class... Args>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_create_node(
+    Args&&... args) {
+    Node* node = Node_Alloc_Traits::allocate(m_node_allocator, 1);
+    try {
+        Node_Alloc_Traits::construct(m_node_allocator, node, 
+                                     std::forward<Args>(args)...);
+    } catch(...) {
+        Node_Alloc_Traits::deallocate(m_node_allocator, node, 1);
+        throw;
+    };
+    m_update(node);
+    return node;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_destroy_node(
+    Node* node) {
+    Node_Alloc_Traits::destroy(m_node_allocator, node);
+    Node_Alloc_Traits::deallocate(m_node_allocator, node, 1);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+std::size_t 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_destroy_subtree(
+    Node* node) {
+    std::size_t count = 0;
+    if(node) {
+        count += m_destroy_subtree(node->left);
+        count += m_destroy_subtree(node->right);
+        m_destroy_node(node);
+        ++count;
+    };
+    return count;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::print() {
+    std::deque<Node*> queue;
     queue.push_back(m_root);
-    Node_Ptr temp_p;
+    Node* temp_p;
     while(!queue.empty()) {
         temp_p = queue.front();
         queue.pop_front();
@@ -207,81 +1725,93 @@ void Tree<T, Compare, Alloc>::print() {
 };
 
 // Erases provided node assuming it belongs to tree
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::iterator 
-Tree<T, Compare, Alloc>::m_erase(Node_Ptr e_node) {
-    if(e_node->left || e_node->right) {
-        Node_Ptr temp = e_node;
-        if(temp->right) {
-            temp = temp->right;
-            while(temp->left) {
-                temp = temp->left;
-            };
-        } else {
-            temp = temp->left;
-            while(temp->right) {
-                temp = temp->right;
-            };
-        };
-        std::swap(temp->value, e_node->value);
-        return m_erase(temp);
-    } else {
-        iterator ret_it = iterator(e_node, this);
-        ++ret_it;
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_erase(Node* e_node) {
+    iterator ret_it = iterator(e_node, this);
+    ++ret_it;
+
+    m_unlink(e_node);
+    m_destroy_node(e_node);
+    --m_size;
+
+    return ret_it;
+};
 
-        Node_Ptr temp = e_node;
-        Node_Ptr parent_cache = e_node->parent.lock();
-        
-        while(temp != m_root) {
-            parent_cache = temp->parent.lock();
-            if((parent_cache->diff == 1) && 
-               (parent_cache->right == temp)) {
-                temp = m_left_balance(parent_cache->left);
-                // Tree height didn't changed in this particular case
-                if(temp->diff != 0) { break; };
-            } else if ((parent_cache->diff == -1) && 
-                       (parent_cache->left == temp)) {
-                temp = m_right_balance(parent_cache->right);
-                // Tree height didn't changed in this particular case
-                if(temp->diff != 0) { break; };
-            } else {
-                if(parent_cache->left == temp) {
-                    (parent_cache->diff)--;
-                    if(parent_cache->diff != 0) { break; };
-                } else {
-                    (parent_cache->diff)++;
-                    if(parent_cache->diff != 0) { break; };
-                };
-                temp = parent_cache;
-            };
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_unlink(Node* e_node) {
+    // the first node has no left child, so its successor is its right 
+    // child or its parent (symmetrically for the last one)
+    if(e_node == m_leftmost) {
+        m_leftmost = e_node->right ? e_node->right : e_node->parent;
+    };
+    if(e_node == m_rightmost) {
+        m_rightmost = e_node->left ? e_node->left : e_node->parent;
+    };
 
-            // if(temp == m_root) { break; };
-            // temp = temp->parent.lock();
-        };
+    // nodes are relinked instead of swapping values, so iterators to 
+    // other elements (ret_it included) stay valid
+    if(e_node->left && e_node->right) {
+        m_swap_with_successor(e_node);
+    };
 
-        // Finally, delete e_node
-        parent_cache = e_node->parent.lock();
-        if(parent_cache->left == e_node) {    //not actually destroyed yet
-            parent_cache->left.reset();
+    // now e_node has at most one child, which is a leaf
+    Node* temp = e_node;
+    Node* parent_cache;
+    
+    while(temp->parent) {
+        parent_cache = temp->parent;
+        if((parent_cache->diff == 1) && 
+           (parent_cache->right == temp)) {
+            temp = m_left_balance(parent_cache->left);
+            // Tree height didn't changed in this particular case
+            if(temp->diff != 0) { break; };
+        } else if ((parent_cache->diff == -1) && 
+                   (parent_cache->left == temp)) {
+            temp = m_right_balance(parent_cache->right);
+            // Tree height didn't changed in this particular case
+            if(temp->diff != 0) { break; };
         } else {
-            parent_cache->right.reset();
+            if(parent_cache->left == temp) {
+                (parent_cache->diff)--;
+                if(parent_cache->diff != 0) { break; };
+            } else {
+                (parent_cache->diff)++;
+                if(parent_cache->diff != 0) { break; };
+            };
+            temp = parent_cache;
         };
-        --m_size;
-
-        return ret_it;
     };
+
+    // Finally, unlink e_node
+    Node* survivor = (temp != e_node) ? temp : e_node->parent;
+    Node* child = e_node->left ? e_node->left : e_node->right;
+    Node* parent = e_node->parent;
+    m_replace(e_node, child);
+    e_node->left = nullptr;
+    e_node->right = nullptr;
+    e_node->parent = nullptr;
+    m_update_path(parent);
+
+    return survivor ? survivor : child;
 };
 
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::iterator 
-Tree<T, Compare, Alloc>::erase(iterator position) {
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::erase(iterator position) {
     return m_erase(position);
 };
 
-template<class T, class Compare, class Alloc>
-std::size_t Tree<T, Compare, Alloc>::erase(const T& key) {
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+std::size_t 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::erase(const T& key) {
     iterator to_erase = find(key);
-    if(to_erase == mc_end) {
+    if(to_erase == end()) {
         return 0;
     } else {
         m_erase(to_erase);
@@ -289,212 +1819,639 @@ std::size_t Tree<T, Compare, Alloc>::erase(const T& key) {
     };
 };
 
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::const_iterator 
-Tree<T, Compare, Alloc>::find(const T& f_value) const {
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::erase(
+    const_iterator first, const_iterator last) {
+    if(first != last) {
+        m_erase_range(&*first, (last != end()) ? &*last : nullptr);
+    };
+    return last;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+std::size_t 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::erase_range(const T& lo, 
+                                                            const T& hi) {
+    const Compare& compare = this->comparator();
+    if(!compare(lo, hi)) {
+        return 0;
+    };
+    return m_erase_range(&lo, &hi);
+};
+
+// The nodes of the range are freed only after both splits, 
+// so the bounds may point into them
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+std::size_t 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_erase_range(
+    const T* lo, const T* hi) {
+    Node* root = m_root;
+    m_root = nullptr;
+    Node* left = nullptr;
+    Node* middle = root;
+    Node* right = nullptr;
+    int left_h = 0;
+    int middle_h = m_height(root);
+    int right_h = 0;
+    Node* first = nullptr;
+    if(lo) {
+        first = m_split(root, middle_h, *lo, left, left_h, middle, middle_h);
+    };
+    if(hi) {
+        Node* inner = middle;
+        int inner_h = middle_h;
+        Node* last = m_split(inner, inner_h, *hi, 
+                             middle, middle_h, right, right_h);
+        if(last) {
+            right = m_join(nullptr, 0, last, right, right_h, right_h);
+        };
+    };
+    int height;
+    m_root = m_join(left, left_h, right, right_h, height);
+    std::size_t erased = m_destroy_subtree(middle);
+    if(first) {
+        m_destroy_node(first);
+        ++erased;
+    };
+    m_size -= erased;
+    m_reset_bounds();
+    return erased;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::node_type 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::extract(
+    const_iterator position) {
+    Node* node = position;
+    m_unlink(node);
+    --m_size;
+    return node_type(node, m_node_allocator);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::node_type 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::extract(const T& key) {
+    const_iterator position = find(key);
+    if(position == end()) {
+        return node_type();
+    };
+    return extract(position);
+};
+
+// The node was unlinked, only its own fields are reset here
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+auto Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::insert(
+    node_type&& handle) -> insert_return_type {
+    if(handle.empty()) {
+        return insert_return_type{end(), false, node_type()};
+    };
+    if(*handle.m_allocator != m_node_allocator) {
+        Result_Pair ret = m_insert(std::move(handle.value()));
+        if(ret.second) {
+            handle = node_type();
+        };
+        return insert_return_type{ret.first, ret.second, std::move(handle)};
+    };
+    Node* node = handle.m_node;
+    Result_Pair ret = m_insert_with(node->value, [node](Node* parent) {
+        node->parent = parent;
+        node->diff = 0;
+        m_update(node);
+        return node;
+    });
+    if(ret.second) {
+        handle.m_node = nullptr;
+    };
+    return insert_return_type{ret.first, ret.second, std::move(handle)};
+};
+
+// Each node of source costs one descent here, it is unlinked from 
+// source only when its key turns out to be missing
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::merge(Tree& source) {
+    if(&source == this) {
+        return;
+    };
+    bool same_allocator = (source.m_node_allocator == m_node_allocator);
+    Node* node = source.m_leftmost;
+    while(node) {
+        Node* next = ++iterator(node, &source);
+        bool inserted = m_insert_with(node->value, [&](Node* parent) {
+            if(!same_allocator) {
+                return m_create_node(parent, std::move(node->value));
+            };
+            source.m_unlink(node);
+            node->parent = parent;
+            node->diff = 0;
+            m_update(node);
+            return node;
+        }).second;
+        if(inserted) {
+            // the moved-from value still has to leave source
+            if(!same_allocator) {
+                source.m_unlink(node);
+                source.m_destroy_node(node);
+            };
+            --source.m_size;
+        };
+        node = next;
+    };
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class Key>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::const_iterator 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_find(
+    const Key& f_value) const {
     if(m_root) {
-        Compare compare = Compare();
-        Node_Ptr temp = m_root;
+        const Node* temp = m_root;
         while(true) {
-            if(compare(f_value, temp->value)) {
+            int order = m_three_way(f_value, temp->value);
+            if(order < 0) {
                 temp = temp->left;
-            } else if (compare(temp->value, f_value)) {
+            } else if (order > 0) {
                 temp = temp->right;
             } else {
-                return const_iterator(temp, this);
+                return const_iterator(const_cast<Node*>(temp), this);
             };
             if(!temp) {
-                return mc_end;
+                return end();
             };
         };
     } else {
-        return mc_end;
+        return end();
+    };
+};
+
+// the answer is the last node where the descent turned left
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class Key>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::const_iterator 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_lower_bound(
+    const Key& key) const {
+    const Compare& compare = this->comparator();
+    Node* bound = nullptr;
+    Node* temp = m_root;
+    while(temp) {
+        if(compare(temp->value, key)) {
+            temp = temp->right;
+        } else {
+            bound = temp;
+            temp = temp->left;
+        };
+    };
+    return const_iterator(bound, this);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class Key>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::const_iterator 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_upper_bound(
+    const Key& key) const {
+    const Compare& compare = this->comparator();
+    Node* bound = nullptr;
+    Node* temp = m_root;
+    while(temp) {
+        if(compare(key, temp->value)) {
+            bound = temp;
+            temp = temp->left;
+        } else {
+            temp = temp->right;
+        };
     };
+    return const_iterator(bound, this);
 };
 
-template<class T, class Compare, class Alloc>
+// after an equal node is met the upper bound is the leftmost node of 
+// its right subtree, so the descent just goes on
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+auto 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::equal_range(
+    const T& key) const -> std::pair<const_iterator, const_iterator> {
+    Node* lower = nullptr;
+    Node* upper = nullptr;
+    Node* temp = m_root;
+    while(temp) {
+        int order = m_three_way(key, temp->value);
+        if(order < 0) {
+            upper = temp;
+            temp = temp->left;
+        } else if(order > 0) {
+            temp = temp->right;
+        } else {
+            lower = temp;
+            for(temp = temp->right; temp; temp = temp->left) {
+                upper = temp;
+            };
+            return std::make_pair(const_iterator(lower, this), 
+                                  const_iterator(upper, this));
+        };
+    };
+    return std::make_pair(const_iterator(upper, this), 
+                          const_iterator(upper, this));
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+std::size_t 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::count(
+    const T& key) const {
+    return (find(key) != end()) ? 1 : 0;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class Key, class C, class>
+std::size_t 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::count(
+    const Key& key) const {
+    std::size_t count = 0;
+    for(const_iterator it = m_lower_bound(key), last = m_upper_bound(key); 
+        it != last; ++it) {
+        ++count;
+    };
+    return count;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class Key, class C, class>
+std::size_t 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::erase(const Key& key) {
+    const_iterator first = m_lower_bound(key);
+    const_iterator last = m_upper_bound(key);
+    std::size_t count = 0;
+    while(first != last) {
+        first = m_erase(first);
+        ++count;
+    };
+    return count;
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
 template<class InsType>
-typename Tree<T, Compare, Alloc>::Result_Pair 
-Tree<T, Compare, Alloc>::m_insert(InsType&& i_value) {
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Result_Pair 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_insert(
+    InsType&& i_value) {
+    return m_insert_with(i_value, [&](Node* parent) {
+        return m_create_node(parent, std::forward<InsType>(i_value));
+    });
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class Key, class Make>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Result_Pair 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_insert_with(
+    const Key& key, Make&& make) {
     if(!m_root) {
-        m_root = std::allocate_shared<Node>(m_raw_allocator, 
-                                            mc_before_begin, 
-                                            std::forward<InsType>(i_value));
+        m_root = make(nullptr);
         ++m_size;
+        m_leftmost = m_root;
+        m_rightmost = m_root;
         return std::make_pair<iterator, bool>(iterator(m_root, this), true);
     } else {
-        Compare compare = Compare();
-        Node_Ptr temp = m_root;
-        bool not_constructed = true;
-        bool contained = false;
-        iterator ret_it(this);
-
-        //inserting
-        while(not_constructed) {
-            if(compare(i_value, temp->value)) {
-                if(!(temp->left)) {
-                    temp->left = 
-                        std::allocate_shared<Node>(m_raw_allocator, 
-                                                   temp, 
-                                                   std::forward<InsType>(i_value));
-                    temp->diff++;
-                    ret_it = iterator(temp->left, this);
-                    not_constructed = false;
-                    ++m_size;
-                } else {
-                    temp = temp->left;
-                };
-            } else if (compare(temp->value, i_value)) {
-                if(!(temp->right)) {
-                    temp->right = 
-                        std::allocate_shared<Node>(m_raw_allocator, 
-                                                   temp, 
-                                                   std::forward<InsType>(i_value));
-                    temp->diff--;
-                    ret_it = iterator(temp->right, this);
-                    not_constructed = false;
-                    ++m_size;
-                } else {
-                    temp = temp->right;
-                };
+        bool inserted;
+        Node* node = m_insert_below(m_root, key, make, inserted);
+        if(inserted) {
+            ++m_size;
+        };
+        return std::make_pair<iterator, bool>(iterator(node, this), 
+                                              std::move(inserted));
+    };
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class InsType>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_insert_below(
+    Node* top, InsType&& i_value, bool& inserted) {
+    return m_insert_below(top, i_value, [&](Node* parent) {
+        return m_create_node(parent, std::forward<InsType>(i_value));
+    }, inserted);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class Key, class Make>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_insert_below(
+    Node* top, const Key& i_value, Make&& make, bool& inserted) {
+    Node* temp = top;
+    Node* ret_node = nullptr;
+
+    //inserting
+    while(!ret_node) {
+        int order = m_three_way(i_value, temp->value);
+        if(order < 0) {
+            if(!(temp->left)) {
+                temp->left = make(temp);
+                ret_node = temp->left;
+                inserted = true;
+            } else {
+                temp = temp->left;
+            };
+        } else if (order > 0) {
+            if(!(temp->right)) {
+                temp->right = make(temp);
+                ret_node = temp->right;
+                inserted = true;
             } else {
-                contained = true;
-                ret_it = iterator(temp, this);
-                not_constructed = false;
+                temp = temp->right;
             };
+        } else {
+            ret_node = temp;
+            inserted = false;
         };
+    };
 
-        if(contained) {
-            return std::make_pair<iterator, bool>(std::move(ret_it),
-                                                  false);
+    // balancing (if insertion took place)
+    if(inserted) {
+        if(temp->left == ret_node && temp == m_leftmost) {
+            m_leftmost = ret_node;
+        } else if(temp->right == ret_node && temp == m_rightmost) {
+            m_rightmost = ret_node;
         };
+        bool grew;
+        m_grow_retrace(ret_node, grew);
+        m_update_path(ret_node);
+    };
+    return ret_node;
+};
 
-        // balancing (if insertion took place)
-        while(temp != m_root) {
-            if(temp->diff == 0) {
-                break;
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class InsType>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_insert_hint(
+    Node* hint, InsType&& i_value) {
+    return m_insert_hint_with(hint, i_value, [&](Node* parent) {
+        return m_create_node(parent, std::forward<InsType>(i_value));
+    }).first;
+};
+
+// The value goes right after hint (or right before it) when it is less 
+// than hint's neighbour; otherwise the search climbs from the neighbour 
+// only until an ancestor bounds the value, then goes down from there
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class Key, class Make>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Result_Pair 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_insert_hint_with(
+    Node* hint, const Key& i_value, Make&& make) {
+    if(!m_root) {
+        return m_insert_with(i_value, make);
+    };
+    if(!hint) {
+        hint = m_rightmost;
+    };
+    Node* top = hint;
+    int order = m_three_way(i_value, hint->value);
+    if(order > 0) {
+        // successor of hint, null for the last node
+        Node* next = nullptr;
+        if(hint != m_rightmost) {
+            next = hint->right;
+            if(next) {
+                while(next->left) {
+                    next = next->left;
+                };
+            } else {
+                next = hint;
+                while(next->parent->right == next) {
+                    next = next->parent;
+                };
+                next = next->parent;
             };
-            Node_Ptr parent_cache = temp->parent.lock();
-            if((parent_cache->diff == 1) && 
-               (parent_cache->left == temp)) {
-                temp = m_left_balance(temp);
-            } else if((parent_cache->diff == -1) && 
-                      (parent_cache->right == temp)) {
-                temp = m_right_balance(temp);
+        };
+        if(next && (order = m_three_way(i_value, next->value)) >= 0) {
+            if(order == 0) {
+                return Result_Pair(iterator(next, this), false);
+            };
+            top = next;
+            while(top->parent && 
+                  (order = m_three_way(i_value, top->parent->value)) > 0) {
+                top = top->parent;
+            };
+            if(top->parent && order == 0) {
+                return Result_Pair(iterator(top->parent, this), false);
+            };
+        };
+    } else if(order < 0) {
+        // predecessor of hint, null for the first node
+        Node* prev = nullptr;
+        if(hint != m_leftmost) {
+            prev = hint->left;
+            if(prev) {
+                while(prev->right) {
+                    prev = prev->right;
+                };
             } else {
-                if(parent_cache->left == temp) {
-                    parent_cache->diff++;
-                } else {
-                    parent_cache->diff--;
+                prev = hint;
+                while(prev->parent->left == prev) {
+                    prev = prev->parent;
                 };
-                temp = parent_cache;
+                prev = prev->parent;
             };
-            // if(temp == m_root) { break; };
-            // temp = temp->parent.lock();
         };
-        return std::make_pair<iterator, bool>(std::move(ret_it), true);
+        if(prev && (order = m_three_way(i_value, prev->value)) <= 0) {
+            if(order == 0) {
+                return Result_Pair(iterator(prev, this), false);
+            };
+            top = prev;
+            while(top->parent && 
+                  (order = m_three_way(i_value, top->parent->value)) < 0) {
+                top = top->parent;
+            };
+            if(top->parent && order == 0) {
+                return Result_Pair(iterator(top->parent, this), false);
+            };
+        };
+    } else {
+        return Result_Pair(iterator(hint, this), false);
     };
+
+    bool inserted;
+    Node* node = m_insert_below(top, i_value, make, inserted);
+    if(inserted) {
+        ++m_size;
+    };
+    return Result_Pair(iterator(node, this), inserted);
 };
  
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::Result_Pair 
-Tree<T, Compare, Alloc>::insert(T&& i_value) {
-    return m_insert(i_value);
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Result_Pair 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::insert(T&& i_value) {
+    return m_insert(std::move(i_value));
 };
 
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::Result_Pair 
-Tree<T, Compare, Alloc>::insert(const T& i_value) {
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Result_Pair 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::insert(const T& i_value) {
     return m_insert(i_value);
 };
 
-// Begin and rbegin iterator getters
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::iterator 
-Tree<T, Compare, Alloc>::begin() const {
-    Node_Ptr temp = m_root;
-    while(temp->left) {
-        temp = temp->left;
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class... Args>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Result_Pair 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::emplace(Args&&... args) {
+    if constexpr(sizeof...(Args) == 1 && 
+                 (std::is_same<std::decay_t<Args>, T>::value && ...)) {
+        return m_insert(std::forward<Args>(args)...);
+    } else {
+        Node* node = m_create_node(nullptr, std::in_place, 
+                                   std::forward<Args>(args)...);
+        Result_Pair ret;
+        try {
+            ret = m_insert_with(node->value, [node](Node* parent) {
+                node->parent = parent;
+                return node;
+            });
+        } catch(...) {
+            m_destroy_node(node);
+            throw;
+        };
+        if(!ret.second) {
+            m_destroy_node(node);
+        };
+        return ret;
     };
-    return iterator(temp, this);
 };
 
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::iterator 
-Tree<T, Compare, Alloc>::before_end() const {
-    Node_Ptr temp = m_root;
-    while(temp->right) {
-        temp = temp->right;
-    };
-    return iterator(temp, this);
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class Key, class... Args>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Result_Pair 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::try_emplace(
+    Key&& key, Args&&... args) {
+    return m_insert_with(key, [&](Node* parent) {
+        return m_create_node(parent, std::in_place, std::forward<Key>(key), 
+                             std::forward<Args>(args)...);
+    });
 };
 
-//Different rotations and balances
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::insert(
+    const_iterator hint, T&& i_value) {
+    return m_insert_hint(hint, std::move(i_value));
+};
 
-// performing rotations with top node given
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::Node_Ptr 
-Tree<T, Compare, Alloc>::m_rotate_right(const Node_Ptr& a) {
-    Node_Ptr b = a->left;
-    if(a == m_root) {
-        m_root = b;
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::insert(
+    const_iterator hint, const T& i_value) {
+    return m_insert_hint(hint, i_value);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class... Args>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::emplace_hint(
+    const_iterator hint, Args&&... args) {
+    if constexpr(sizeof...(Args) == 1 && 
+                 (std::is_same<std::decay_t<Args>, T>::value && ...)) {
+        return m_insert_hint(hint, std::forward<Args>(args)...);
     } else {
-        Node_Ptr parent_cache = a->parent.lock();
-        if(parent_cache->right == a) {
-            parent_cache->right = b;
-        } else {
-            parent_cache->left = b;
+        // built in place first, like emplace, and dropped for a duplicate
+        Node* node = m_create_node(nullptr, std::in_place, 
+                                   std::forward<Args>(args)...);
+        Result_Pair ret;
+        try {
+            ret = m_insert_hint_with(hint, node->value, [node](Node* parent) {
+                node->parent = parent;
+                return node;
+            });
+        } catch(...) {
+            m_destroy_node(node);
+            throw;
         };
+        if(!ret.second) {
+            m_destroy_node(node);
+        };
+        return ret.first;
     };
-    b->parent = a->parent;
+};
+
+// Begin and rbegin iterator getters
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::begin() const {
+    return iterator(m_leftmost, this);
+};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::before_end() const {
+    return iterator(m_rightmost, this);
+};
+
+//Different rotations and balances
+
+// performing rotations with top node given
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_rotate_right(Node* a) {
+    Node* b = a->left;
+    m_replace(a, b);
 
     m_emplace_left(b->right, a);
     m_emplace_right(a, b);
     if(b->diff == 1) {a->diff = 0; b->diff = 0;}
     else if (b->diff == 0) {a->diff = 1; b->diff = -1;};
+    m_update(a);
+    m_update(b);
     return b;
 };
 
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::Node_Ptr 
-Tree<T, Compare, Alloc>::m_rotate_left(const Node_Ptr& a) {
-    Node_Ptr b = a->right;
-    if(a == m_root) {
-        m_root = b;
-    } else {
-        Node_Ptr parent_cache = a->parent.lock();
-        if(parent_cache->right == a) {
-            parent_cache->right = b;
-        } else {
-            parent_cache->left = b;
-        };
-    };
-    b->parent = a->parent;
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_rotate_left(Node* a) {
+    Node* b = a->right;
+    m_replace(a, b);
     
     m_emplace_right(b->left, a);
     m_emplace_left(a, b);
     if(b->diff == -1) {a->diff = 0; b->diff = 0;}
     else if (b->diff == 0) {a->diff = -1; b->diff = 1;};
+    m_update(a);
+    m_update(b);
     return b;
 };
 
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::Node_Ptr 
-Tree<T, Compare, Alloc>::m_big_rotate_right(const Node_Ptr& a) {
-    Node_Ptr b = a->left;
-    Node_Ptr c = b->right;
-    if(a == m_root) {
-        m_root = c;
-    } else {
-        Node_Ptr parent_cache = a->parent.lock();
-        if(parent_cache->right == a) {
-            parent_cache->right = c;
-        } else {
-            parent_cache->left = c;
-        };
-    };
-    c->parent = a->parent;
-    uint8_t temp_diff_c = c->diff;
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_big_rotate_right(
+    Node* a) {
+    Node* b = a->left;
+    Node* c = b->right;
+    m_replace(a, c);
+    int8_t temp_diff_c = c->diff;
 
     m_emplace_left(c->right, a);
     m_emplace_right(c->left, b);
@@ -504,26 +2461,21 @@ Tree<T, Compare, Alloc>::m_big_rotate_right(const Node_Ptr& a) {
     if (temp_diff_c == -1) {a->diff = 0; b->diff = 1; c->diff = 0;}
     else if (temp_diff_c == 0) {a->diff = 0; b->diff = 0; c->diff = 0;}
     else if (temp_diff_c == 1) {a->diff = -1; b->diff = 0; c->diff = 0;};
+    m_update(a);
+    m_update(b);
+    m_update(c);
     return c;
 };
 
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::Node_Ptr 
-Tree<T, Compare, Alloc>::m_big_rotate_left(const Node_Ptr& a) {
-    Node_Ptr b = a->right;
-    Node_Ptr c = b->left;
-    if(a == m_root) {
-        m_root = c;
-    } else {
-        Node_Ptr parent_cache = a->parent.lock();
-        if(parent_cache->right == a) {
-            parent_cache->right = c;
-        } else {
-            parent_cache->left = c;
-        };
-    };
-    c->parent = a->parent;
-    uint8_t temp_diff_c = c->diff;
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_big_rotate_left(
+    Node* a) {
+    Node* b = a->right;
+    Node* c = b->left;
+    m_replace(a, c);
+    int8_t temp_diff_c = c->diff;
 
     m_emplace_right(c->left, a);
     m_emplace_left(c->right, b);
@@ -533,15 +2485,54 @@ Tree<T, Compare, Alloc>::m_big_rotate_left(const Node_Ptr& a) {
     if (temp_diff_c == -1) {a->diff = 1; b->diff = 0; c->diff = 0;}
     else if (temp_diff_c == 0) {a->diff = 0; b->diff = 0; c->diff = 0;}
     else if (temp_diff_c == 1) {a->diff = 0; b->diff = -1; c->diff = 0;};
+    m_update(a);
+    m_update(b);
+    m_update(c);
     return c;
 };
 
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_grow_retrace(
+    Node* grown, bool& grew) {
+    Node* temp = grown;
+    grew = true;
+    while(temp->parent) {
+        Node* parent_cache = temp->parent;
+        if(parent_cache->left == temp) {
+            if(parent_cache->diff == 1) {
+                temp = m_left_balance(temp);
+            } else {
+                parent_cache->diff++;
+                temp = parent_cache;
+            };
+        } else {
+            if(parent_cache->diff == -1) {
+                temp = m_right_balance(temp);
+            } else {
+                parent_cache->diff--;
+                temp = parent_cache;
+            };
+        };
+        // rotations and diff changes that end with a balanced node 
+        // keep the subtree height as it was before growing
+        if(temp->diff == 0) {
+            grew = false;
+            break;
+        };
+    };
+    return temp;
+};
+
 // performing balancing dependent on node b from which we reach top node a to perform rotation with
 // returns top node of a result subtree
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::Node_Ptr 
-Tree<T, Compare, Alloc>::m_left_balance(const Node_Ptr& node) {
-    Node_Ptr parent = node->parent.lock();
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_left_balance(
+    Node* node) {
+    Node* parent = node->parent;
     if(node->diff == -1) {
         return m_big_rotate_right(parent);
     } else {
@@ -549,10 +2540,12 @@ Tree<T, Compare, Alloc>::m_left_balance(const Node_Ptr& node) {
     };
 };
 
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::Node_Ptr 
-Tree<T, Compare, Alloc>::m_right_balance(const Node_Ptr& node) {
-    Node_Ptr parent = node->parent.lock();
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node* 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_right_balance(
+    Node* node) {
+    Node* parent = node->parent;
     if(node->diff == 1) {
         return m_big_rotate_left(parent);
     } else {
@@ -561,78 +2554,140 @@ Tree<T, Compare, Alloc>::m_right_balance(const Node_Ptr& node) {
 };
 
 // emplaces subtree with top node instead of right or left parent's subtree
-template<class T, class Compare, class Alloc>
-void Tree<T, Compare, Alloc>::m_emplace_right(const Node_Ptr& node, 
-                                              const Node_Ptr& parent) {
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_emplace_right(
+    Node* node, Node* parent) {
     if(node) {
         node->parent = parent;
     };
     parent->right = node;
 };
 
-template<class T, class Compare, class Alloc>
-void Tree<T, Compare, Alloc>::m_emplace_left(const Node_Ptr& node, 
-                                             const Node_Ptr& parent) {
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_emplace_left(
+    Node* node, Node* parent) {
     if(node) {
         node->parent = parent;
     };
     parent->left = node;
 };
 
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_replace(
+    Node* old_node, Node* new_node) {
+    Node* parent = old_node->parent;
+    if(!parent) {
+        // detached subtrees have no parent either, only touch the real root
+        if(old_node == m_root) {
+            m_root = new_node;
+        };
+    } else if(parent->left == old_node) {
+        parent->left = new_node;
+    } else {
+        parent->right = new_node;
+    };
+    if(new_node) {
+        new_node->parent = parent;
+    };
+};
 
-// structure Tree<T>::Node methods
-
-template<class T, class Compare, class Alloc>
-Tree<T, Compare, Alloc>::Node::Node(const Node_Ptr& parent, 
-                                    const T& value) 
-    : parent(parent), value(value), diff(0) {};
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::m_swap_with_successor(
+    Node* node) {
+    Node* succ = node->right;
+    while(succ->left) {
+        succ = succ->left;
+    };
+    Node* succ_parent = succ->parent;
+    Node* succ_right = succ->right;
 
-template<class T, class Compare, class Alloc>
-Tree<T, Compare, Alloc>::Node::Node(const Node_Ptr& parent, T&& value) 
-    : parent(parent), value(value), diff(0) {};
+    m_replace(node, succ);
+    m_emplace_left(node->left, succ);
+    if(succ_parent == node) {
+        m_emplace_right(node, succ);
+    } else {
+        m_emplace_right(node->right, succ);
+        m_emplace_left(node, succ_parent);
+    };
+    node->left = nullptr;
+    m_emplace_right(succ_right, node);
+    std::swap(node->diff, succ->diff);
+};
 
 
-// class Tree<T>::iterator methods
+// structure Tree<T>::Node methods
 
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::iterator& 
-Tree<T, Compare, Alloc>::iterator::operator=(
-        typename Tree<T, Compare, Alloc>::iterator&& to_move) {
-    if(&to_move == this) {
-        return *this;
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node::Node(Node* parent, 
+                                                                 const T& value)
+    : left(nullptr), right(nullptr), parent(parent), 
+      diff(0), value(value) {};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node::Node(Node* parent, 
+                                                                 T&& value)
+    : left(nullptr), right(nullptr), parent(parent), 
+      diff(0), value(std::move(value)) {};
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+template<class... Args>
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node::Node(
+    Node* parent, std::in_place_t, Args&&... args)
+    : left(nullptr), right(nullptr), parent(parent), 
+      diff(0), value(std::forward<Args>(args)...) {};
+
+
+// class Tree<T>::Node_Handle methods
+
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node_Handle& 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node_Handle::operator=(
+    Node_Handle&& other) noexcept {
+    if(this != &other) {
+        m_reset();
+        m_node = other.m_node;
+        m_allocator = std::move(other.m_allocator);
+        other.m_node = nullptr;
     };
-    self = std::move(to_move.self); 
-    owner = std::move(to_move.owner);
     return *this;
 };
 
-
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::iterator& 
-Tree<T, Compare, Alloc>::iterator::operator=(
-        const typename Tree<T, Compare, Alloc>::iterator& to_copy) { 
-    if(&to_copy == this) {
-        return *this;
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+void 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::Node_Handle::m_reset() {
+    if(m_node) {
+        Node_Alloc_Traits::destroy(*m_allocator, m_node);
+        Node_Alloc_Traits::deallocate(*m_allocator, m_node, 1);
+        m_node = nullptr;
     };
-    self = to_copy.self; 
-    owner = to_copy.owner;
-    return *this;
 };
 
-// for LegacyIterator
-template<class T, class Compare, class Alloc>
-const T& Tree<T, Compare, Alloc>::iterator::operator*() const {
-    return self.lock()->value;
-};
 
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::iterator& 
-Tree<T, Compare, Alloc>::iterator::operator++() {
-    if(*this == owner->mc_before_begin) {
+// class Tree<T>::iterator methods
+
+// for LegacyIterator
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator& 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator::operator++() {
+    if(!self) {
         *this = owner->begin();
         return *this;
     };
-    Node_Ptr temp = self.lock();
+    Node* temp = self;
     if(temp->right) {
         temp = temp->right;
         while(temp->left) {
@@ -641,12 +2696,9 @@ Tree<T, Compare, Alloc>::iterator::operator++() {
         self = temp;
         return *this;
     } else {
-        while(temp->parent.lock()->left != temp) {
-            temp = temp->parent.lock();
-            if(temp == owner->m_root) { 
-                self = owner->mc_end; 
-                return *this; 
-            };
+        // climbing out of the root gives the null past-the-end node
+        while(temp->parent && temp->parent->left != temp) {
+            temp = temp->parent;
         };
         self = temp->parent;
         return *this;
@@ -654,40 +2706,26 @@ Tree<T, Compare, Alloc>::iterator::operator++() {
 };    
 
 // for LegacyInputIterator
-template<class T, class Compare, class Alloc>
-bool Tree<T, Compare, Alloc>::iterator::operator==(     // EqualityComparable
-        const iterator& to_compare) const {        
-    return (self.lock() == to_compare.self.lock());
-};
-
-template<class T, class Compare, class Alloc>
-bool Tree<T, Compare, Alloc>::iterator::operator!=(
-        const iterator& to_compare) const {
-    return !(*this == to_compare);
-};
-
-template<class T, class Compare, class Alloc>
-const T* Tree<T, Compare, Alloc>::iterator::operator->() const {
-    return &(self.lock()->value);
-};
-
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::iterator 
-Tree<T, Compare, Alloc>::iterator::operator++(int) {
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator::operator++(
+    int) {
     iterator temp = *this;
     ++(*this);
     return temp; 
 };
 
 // for BidirectionalIterator
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::iterator& 
-Tree<T, Compare, Alloc>::iterator::operator--() {
-    if(*this == owner->mc_end) {
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator& 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator::operator--() {
+    if(!self) {
         *this = owner->before_end();
         return *this;
     };
-    Node_Ptr temp = self.lock();
+    Node* temp = self;
     if(temp->left) {
         temp = temp->left;
         while(temp->right) {
@@ -696,21 +2734,20 @@ Tree<T, Compare, Alloc>::iterator::operator--() {
         self = temp;
         return *this;
     } else {
-        while(temp->parent.lock()->right != temp) {
-            temp = temp->parent.lock();
-            if(temp == owner->m_root) { 
-                self = owner->mc_before_begin;
-                return *this; 
-            };
+        // climbing out of the root gives the null before-begin node
+        while(temp->parent && temp->parent->right != temp) {
+            temp = temp->parent;
         };
         self = temp->parent;
         return *this;
     };
 };
 
-template<class T, class Compare, class Alloc>
-typename Tree<T, Compare, Alloc>::iterator 
-Tree<T, Compare, Alloc>::iterator::operator--(int) {
+template<class T, class Compare, class Alloc, bool Order_Statistics, 
+         class Aggregate>
+typename Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator 
+Tree<T, Compare, Alloc, Order_Statistics, Aggregate>::iterator::operator--(
+    int) {
     iterator temp = *this;
     --(*this);
     return temp;